@@ -0,0 +1,98 @@
+// Per-request cost of AccessLog::log() as the request-id middleware calls
+// it: build a record (wall clock, id, peer, ...) and push it into the
+// thread's ring, with the writer thread draining to a file in the
+// background. Reports ns per record over building the record alone, at 1
+// and 4 recording threads and in both formats, plus how many were dropped.
+//
+//   ./access_log_bench [records-per-thread] [log-path]
+#include "../src/router/AccessLog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+AccessRecord makeRecord(uint64_t i) {
+  AccessRecord r;
+  r.timeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  r.bytes = 512 + (i & 1023);
+  r.latencyUs = uint32_t(100 + (i & 255));
+  r.routeId = int32_t(i & 7);
+  r.status = 200;
+  r.method = uint8_t(Method::Get);
+  r.setRequestId("0123456789abcdef0123456789abcdef");
+  r.peerFamily = AF_INET;
+  r.peerPort = uint16_t(40000 + (i & 1023));
+  r.peerAddr[0] = 10; r.peerAddr[3] = uint8_t(i);
+  return r;
+}
+
+// ns per record across `threads` threads, each logging `n` records in
+// bursts of kBurst with a pause in between: about 100k requests/s per
+// thread, a busy IO thread, which also leaves the writer room to run on a
+// single core. Only the bursts are timed.
+constexpr size_t kBurst = 256;
+
+double run(AccessLog* log, size_t threads, size_t n) {
+  std::vector<std::thread> ts;
+  std::vector<double> nsPer(threads);
+  for (size_t t = 0; t < threads; t++) {
+    ts.emplace_back([&, t] {
+      double spent = 0;
+      volatile uint64_t sink = 0;
+      for (size_t i = 0; i < n;) {
+        const auto t0 = Clock::now();
+        for (size_t end = std::min(n, i + kBurst); i < end; i++) {
+          AccessRecord r = makeRecord(i);
+          if (log) log->log(r);
+          else sink = sink + r.bytes;
+        }
+        spent += std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+        std::this_thread::sleep_for(std::chrono::microseconds(2500));
+      }
+      nsPer[t] = spent / double(n);
+    });
+  }
+  for (auto& t : ts) t.join();
+  double sum = 0;
+  for (double v : nsPer) sum += v;
+  return sum / double(threads);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+  const std::string path = argc > 2 ? argv[2] : "/tmp/access_log_bench.log";
+
+  std::printf("%8s %7s %12s %12s %10s %10s\n", "format", "threads", "build ns", "build+log ns",
+              "overhead", "dropped");
+  for (auto fmt : {AccessLogOptions::Format::JsonLines, AccessLogOptions::Format::Binary}) {
+    for (size_t threads : {1, 4}) {
+      std::remove(path.c_str());
+      const double base = run(nullptr, threads, n);
+      Metrics metrics;
+      double logged;
+      uint64_t dropped;
+      {
+        AccessLogOptions o;
+        o.path = path;
+        o.format = fmt;
+        AccessLog log(o, &metrics);
+        logged = run(&log, threads, n);
+        dropped = log.dropped();
+      }
+      std::printf("%8s %7zu %12.1f %12.1f %10.1f %10llu\n",
+                  fmt == AccessLogOptions::Format::Binary ? "binary" : "json", threads, base, logged,
+                  logged - base, (unsigned long long)dropped);
+    }
+  }
+  std::remove(path.c_str());
+}
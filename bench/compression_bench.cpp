@@ -0,0 +1,92 @@
+// Throughput (MB/s) and p99 added latency of the compression stage against
+// the original one-shot gzipCompress/brotliCompress helpers.
+//
+//   ./compression_bench [iterations]
+#include "../src/router/Compression.h"
+
+#include <brotli/encode.h>
+#include <zlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Baselines, kept verbatim from the original Compression.h.
+bool gzipCompress(const std::string& in,std::string& out){
+  z_stream zs{}; if(deflateInit2(&zs,Z_BEST_SPEED,Z_DEFLATED,15+16,8,Z_DEFAULT_STRATEGY)!=Z_OK) return false;
+  zs.next_in=(Bytef*)in.data(); zs.avail_in=uInt(in.size());
+  char buf[1<<14]; int ret; do{ zs.next_out=(Bytef*)buf; zs.avail_out=sizeof(buf);
+    ret=deflate(&zs,zs.avail_in?Z_NO_FLUSH:Z_FINISH);
+    out.append(buf,sizeof(buf)-zs.avail_out);
+  } while(ret==Z_OK); deflateEnd(&zs); return ret==Z_STREAM_END;
+}
+bool brotliCompress(const std::string& in,std::string& out){
+  size_t out_len=BrotliEncoderMaxCompressedSize(in.size()); out.resize(out_len);
+  auto ok=BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY,BROTLI_DEFAULT_WINDOW,BROTLI_MODE_GENERIC,
+    in.size(),(const uint8_t*)in.data(),&out_len,(uint8_t*)out.data());
+  if(!ok) return false; out.resize(out_len); return true;
+}
+
+std::string jsonBody(size_t n) {
+  std::string s = "[";
+  for (size_t i=0; s.size()<n; i++)
+    s += "{\"id\":" + std::to_string(i) + ",\"username\":\"user" + std::to_string(i*7919) +
+         "\",\"email\":\"user" + std::to_string(i) + "@example.com\"},";
+  s.resize(n);
+  return s;
+}
+
+struct Result { double mbps, p99us; size_t outBytes; };
+
+template <class F>
+Result run(const std::string& body, size_t iters, F&& f) {
+  std::vector<double> us; us.reserve(iters);
+  size_t outBytes = 0;
+  for (size_t i=0; i<iters; i++) {
+    auto t0 = std::chrono::steady_clock::now();
+    outBytes = f();
+    auto t1 = std::chrono::steady_clock::now();
+    us.push_back(std::chrono::duration<double,std::micro>(t1-t0).count());
+  }
+  double total = 0; for (double u : us) total += u;
+  std::sort(us.begin(), us.end());
+  return {double(body.size()) * iters / total, us[size_t(us.size()*0.99)], outBytes};
+}
+
+void row(const char* name, size_t size, const Result& r) {
+  std::printf("%-16s %9zu %10.1f %10.1f %10zu\n", name, size, r.mbps, r.p99us, r.outBytes);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const size_t iters = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200;
+  CompressionOptions opts;
+  opts.adaptiveLevel = false;
+  std::printf("%-16s %9s %10s %10s %10s\n", "encoder", "bytes", "MB/s", "p99 us", "out bytes");
+
+  for (size_t size : {size_t(5), size_t(2048), size_t(64*1024), size_t(1<<20)}) {
+    const std::string body = jsonBody(size);
+    const size_t n = size >= (1<<20) ? std::max<size_t>(iters/20, 5) : iters;
+    const auto in = folly::IOBuf::wrapBufferAsValue(body.data(), body.size());
+
+    row("gzip (old)", size, run(body, n, [&]{ std::string o; gzipCompress(body, o); return o.size(); }));
+    row("gzip (stage)", size, run(body, n, [&]{
+      if (body.size() < opts.minBytes) return body.size();
+      return compressBody(Encoding::Gzip, in, compressionLevel(Encoding::Gzip, opts))->computeChainDataLength();
+    }));
+    row("gzip (stage,l1)", size, run(body, n, [&]{
+      if (body.size() < opts.minBytes) return body.size();
+      return compressBody(Encoding::Gzip, in, Z_BEST_SPEED)->computeChainDataLength();
+    }));
+    row("br (old)", size, run(body, n, [&]{ std::string o; brotliCompress(body, o); return o.size(); }));
+    row("br (stage)", size, run(body, n, [&]{
+      if (body.size() < opts.minBytes) return body.size();
+      return compressBody(Encoding::Brotli, in, compressionLevel(Encoding::Brotli, opts))->computeChainDataLength();
+    }));
+  }
+}
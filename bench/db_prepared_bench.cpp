@@ -0,0 +1,58 @@
+// User lookup by id against a local Postgres: SQL text through txn.exec
+// (what UserService did before) against the prepared statement it uses
+// now. Reports queries/s and p50/p99 latency, single connection.
+//
+//   DATABASE_URL=postgresql://... ./db_prepared_bench [queries]
+#include <pqxx/pqxx>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+const char* kSql = "SELECT id, username, email FROM users WHERE id=$1";
+
+struct Result { double qps, p50us, p99us; };
+
+template <class F>
+Result run(pqxx::connection& c, size_t n, F&& query) {
+  std::vector<double> us; us.reserve(n);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i=0; i<n; i++) {
+    auto t0 = std::chrono::steady_clock::now();
+    pqxx::work txn(c);
+    auto r = query(txn, int(i % 1000) + 1);
+    txn.commit();
+    auto t1 = std::chrono::steady_clock::now();
+    us.push_back(std::chrono::duration<double,std::micro>(t1-t0).count());
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  std::sort(us.begin(), us.end());
+  return {double(n) / secs, us[us.size()/2], us[size_t(us.size()*0.99)]};
+}
+
+void row(const char* name, const Result& r) {
+  std::printf("%-12s %12.0f %10.1f %10.1f\n", name, r.qps, r.p50us, r.p99us);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* url = std::getenv("DATABASE_URL");
+  if (!url) { std::fprintf(stderr, "DATABASE_URL not set\n"); return 1; }
+  const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20'000;
+
+  pqxx::connection c(url);
+  c.prepare("users_by_id", kSql);
+
+  // Warm the connection and the table's pages before timing either path.
+  run(c, 500, [](pqxx::work& t, int id){ return t.exec(kSql, pqxx::params(id)); });
+
+  std::printf("%-12s %12s %10s %10s\n", "lookup", "queries/s", "p50 us", "p99 us");
+  row("text", run(c, n, [](pqxx::work& t, int id){ return t.exec(kSql, pqxx::params(id)); }));
+  row("prepared", run(c, n, [](pqxx::work& t, int id){
+    return t.exec(pqxx::prepped{"users_by_id"}, pqxx::params(id));
+  }));
+}
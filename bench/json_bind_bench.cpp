@@ -0,0 +1,87 @@
+// Parse + bind cost of a /register body: nlohmann DOM parse and three
+// field reads (the old handler) against simdjson on-demand bindJson, for
+// a small body and a ~1 MB one (the same fields plus a large ignored
+// payload).
+//
+//   ./json_bind_bench [iterations]
+#include "../src/router/JsonBind.h"
+
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Register { std::string username, password, email; };
+
+} // namespace
+
+template <> struct JsonSchema<Register> {
+  static constexpr auto fields = std::make_tuple(
+    jsonRequired("username", &Register::username),
+    jsonRequired("password", &Register::password),
+    jsonRequired("email", &Register::email));
+};
+
+namespace {
+
+std::string body(size_t padTo) {
+  std::string s = R"({"username":"alice","password":"correct horse battery staple","email":"alice@example.com")";
+  if (padTo) {
+    s += R"(,"profile":[)";
+    for (size_t i=0; s.size() < padTo; i++)
+      s += "{\"id\":" + std::to_string(i) + ",\"tag\":\"item" + std::to_string(i*31) + "\"},";
+    s.back() = ']';
+  }
+  return s + "}";
+}
+
+struct Result { double mbps, p50us, p99us; };
+
+template <class F>
+Result run(size_t bytes, size_t iters, F&& f) {
+  std::vector<double> us; us.reserve(iters);
+  for (size_t i=0; i<iters; i++) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    auto t1 = std::chrono::steady_clock::now();
+    us.push_back(std::chrono::duration<double,std::micro>(t1-t0).count());
+  }
+  double total = 0; for (double u : us) total += u;
+  std::sort(us.begin(), us.end());
+  return {double(bytes) * iters / total, us[us.size()/2], us[size_t(us.size()*0.99)]};
+}
+
+void row(const char* name, size_t size, const Result& r) {
+  std::printf("%-10s %9zu %10.1f %10.2f %10.2f\n", name, size, r.mbps, r.p50us, r.p99us);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const size_t iters = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20'000;
+  std::printf("%-10s %9s %10s %10s %10s\n", "parser", "bytes", "MB/s", "p50 us", "p99 us");
+  for (size_t pad : {size_t(0), size_t(1) << 20}) {
+    const std::string s = body(pad);
+    // Like a request body: one buffer, read by proxygen with spare tailroom.
+    auto buf = folly::IOBuf::create(s.size() + 4096);
+    std::memcpy(buf->writableData(), s.data(), s.size());
+    buf->append(s.size());
+    const size_t n = pad ? std::max<size_t>(iters / 200, 20) : iters;
+
+    row("nlohmann", s.size(), run(s.size(), n, [&] {
+      auto bytes = buf->coalesce();
+      auto j = nlohmann::json::parse(bytes.begin(), bytes.end());
+      Register r{j["username"], j["password"], j["email"]};
+      if (r.username.empty()) std::abort();
+    }));
+    row("simdjson", s.size(), run(s.size(), n, [&] {
+      Register r; std::string err;
+      if (!bindJson(*buf, r, err)) std::abort();
+    }));
+  }
+}
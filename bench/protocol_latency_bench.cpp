@@ -0,0 +1,207 @@
+// Latency of concurrent requests to the router over h1, h2c and h3 on
+// loopback. Each round sends `streams` GETs at once: over h1 on that many
+// connections (HTTP/1.1 cannot multiplex), over h2c and h3 as streams on one
+// connection. Reports p50/p99 per request across all rounds. Note h3 is
+// always encrypted while h1/h2c here are not.
+//
+//   ./protocol_latency_bench cert.pem key.pem [streams] [rounds]
+#include "../src/router/Router.h"
+#include "../src/server/H3Listener.h"
+#include "../src/server/ServerConfig.h"
+
+#include <fizz/client/FizzClientContext.h>
+#include <fizz/protocol/CertificateVerifier.h>
+#include <folly/io/async/EventBase.h>
+#include <proxygen/httpserver/HTTPServer.h>
+#include <proxygen/lib/http/HQConnector.h>
+#include <proxygen/lib/http/HTTPConnector.h>
+#include <proxygen/lib/http/codec/HTTP2Framer.h>
+#include <proxygen/lib/http/session/HQUpstreamSession.h>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// One GET; records its latency when the response ends.
+class Get : public proxygen::HTTPTransactionHandler {
+ public:
+  Get(std::vector<double>& out, std::function<void()> done) : out_(out), done_(std::move(done)) {}
+
+  void send(proxygen::HTTPTransaction* txn, const std::string& authority) {
+    proxygen::HTTPMessage req;
+    req.setMethod(proxygen::HTTPMethod::GET);
+    req.setURL("/ping");
+    req.getHeaders().set(proxygen::HTTP_HEADER_HOST, authority);
+    start_ = Clock::now();
+    txn->sendHeaders(req);
+    txn->sendEOM();
+  }
+
+  void setTransaction(proxygen::HTTPTransaction*) noexcept override {}
+  void detachTransaction() noexcept override { delete this; }
+  void onHeadersComplete(std::unique_ptr<proxygen::HTTPMessage>) noexcept override {}
+  void onBody(std::unique_ptr<folly::IOBuf>) noexcept override {}
+  void onTrailers(std::unique_ptr<proxygen::HTTPHeaders>) noexcept override {}
+  void onEOM() noexcept override {
+    out_.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start_).count());
+    done_();
+  }
+  void onUpgrade(proxygen::UpgradeProtocol) noexcept override {}
+  void onError(const proxygen::HTTPException& e) noexcept override {
+    std::fprintf(stderr, "request failed: %s\n", e.what());
+    done_();
+  }
+  void onEgressPaused() noexcept override {}
+  void onEgressResumed() noexcept override {}
+
+ private:
+  std::vector<double>& out_;
+  std::function<void()> done_;
+  Clock::time_point start_;
+};
+
+struct TcpDial : proxygen::HTTPConnector::Callback {
+  proxygen::HTTPUpstreamSession* session = nullptr;
+  void connectSuccess(proxygen::HTTPUpstreamSession* s) override { session = s; }
+  void connectError(const folly::AsyncSocketException& e) override {
+    std::fprintf(stderr, "connect failed: %s\n", e.what());
+  }
+};
+
+// The bench server's certificate is whatever was passed in: accept it.
+class AcceptAnyCert : public fizz::CertificateVerifier {
+ public:
+  std::shared_ptr<const folly::AsyncTransportCertificate> verify(
+      const std::vector<std::shared_ptr<const fizz::PeerCert>>& certs) const override {
+    return certs.front();
+  }
+  std::vector<fizz::Extension> getCertificateRequestExtensions() const override { return {}; }
+};
+
+struct QuicDial : proxygen::HQConnector::Callback {
+  proxygen::HQUpstreamSession* session = nullptr;
+  void connectSuccess(proxygen::HQUpstreamSession* s) override { session = s; }
+  void connectError(const quic::QuicError& e) override {
+    std::fprintf(stderr, "quic connect failed: %s\n", quic::toString(e.code).c_str());
+  }
+};
+
+// Runs `rounds` rounds of `streams` concurrent GETs spread over `sessions`.
+std::vector<double> measure(folly::EventBase& evb, const std::vector<proxygen::HTTPSessionBase*>& sessions,
+                            size_t streams, size_t rounds, const std::string& authority) {
+  std::vector<double> us;
+  for (size_t r = 0; r < rounds; r++) {
+    size_t left = streams;
+    for (size_t i = 0; i < streams; i++) {
+      auto* get = new Get(us, [&] { if (--left == 0) evb.terminateLoopSoon(); });
+      auto* txn = sessions[i % sessions.size()]->newTransaction(get);
+      if (!txn) { delete get; left--; continue; }
+      get->send(txn, authority);
+    }
+    if (left) evb.loopForever();
+  }
+  std::sort(us.begin(), us.end());
+  return us;
+}
+
+void report(const char* proto, std::vector<double> us) {
+  if (us.empty()) { std::printf("%6s %10s\n", proto, "failed"); return; }
+  std::printf("%6s %10.1f %10.1f %10zu\n", proto, us[us.size() / 2], us[us.size() * 99 / 100], us.size());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 3) { std::fprintf(stderr, "usage: %s cert.pem key.pem [streams] [rounds]\n", argv[0]); return 2; }
+  const size_t streams = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 32;
+  const size_t rounds = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 500;
+
+  ServerConfig cfg;
+  cfg.host = "127.0.0.1";
+  cfg.httpPort = 18443;
+  cfg.h3Port = 18444;
+  cfg.certFile = argv[1];
+  cfg.keyFile = argv[2];
+  cfg.threads = 2;
+  cfg.maxConcurrentStreams = uint32_t(std::max<size_t>(streams, 100));
+
+  auto router = std::make_unique<RouterFactory>();
+  router->get("/ping", [](Res& res) { res.staticBody("pong\n"); });
+  router->freeze();
+  H3Listener h3(cfg, router.get());
+  proxygen::HTTPServerOptions opt;
+  cfg.apply(opt);
+  opt.handlerFactories = proxygen::RequestHandlerChain().addThen(std::move(router)).build();
+  proxygen::HTTPServer srv(std::move(opt));
+  srv.bind(cfg.tcpListeners());
+  std::thread serverThread([&] { srv.start(); });
+  h3.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+  folly::EventBase evb;
+  auto timer = folly::HHWheelTimer::newTimer(&evb, folly::HHWheelTimer::DEFAULT_TICK_INTERVAL,
+                                             folly::AsyncTimeout::InternalEnum::NORMAL,
+                                             std::chrono::seconds(10));
+  const folly::SocketAddress tcpAddr("127.0.0.1", cfg.httpPort), udpAddr("127.0.0.1", cfg.h3Port);
+  const std::string authority = "127.0.0.1";
+  std::printf("%6s %10s %10s %10s\n", "proto", "p50 us", "p99 us", "requests");
+
+  // h1: one connection per concurrent request.
+  {
+    std::vector<std::unique_ptr<TcpDial>> dials;
+    std::vector<std::unique_ptr<proxygen::HTTPConnector>> connectors;
+    std::vector<proxygen::HTTPSessionBase*> sessions;
+    for (size_t i = 0; i < streams; i++) {
+      dials.push_back(std::make_unique<TcpDial>());
+      connectors.push_back(std::make_unique<proxygen::HTTPConnector>(dials.back().get(), timer.get()));
+      connectors.back()->connect(&evb, tcpAddr, std::chrono::seconds(2));
+    }
+    evb.loop();
+    for (auto& d : dials) if (d->session) sessions.push_back(d->session);
+    if (sessions.size() == streams) report("h1", measure(evb, sessions, streams, rounds, authority));
+    else report("h1", {});
+    for (auto* s : sessions) s->drain();
+    evb.loop();
+  }
+
+  // h2c: prior knowledge, all streams on one connection.
+  {
+    TcpDial dial;
+    proxygen::HTTPConnector connector(&dial, timer.get());
+    connector.setPlaintextProtocol(proxygen::http2::kProtocolCleartextString);
+    connector.connect(&evb, tcpAddr, std::chrono::seconds(2));
+    evb.loop();
+    if (dial.session) report("h2c", measure(evb, {dial.session}, streams, rounds, authority));
+    else report("h2c", {});
+    if (dial.session) dial.session->drain();
+    evb.loop();
+  }
+
+  // h3: all streams on one QUIC connection.
+  {
+    QuicDial dial;
+    proxygen::HQConnector connector(&dial, std::chrono::seconds(10));
+    auto ctx = std::make_shared<fizz::client::FizzClientContext>();
+    ctx->setSupportedAlpns({"h3"});
+    connector.connect(&evb, folly::none, udpAddr, std::move(ctx),
+                      std::make_shared<AcceptAnyCert>(),
+                      std::chrono::seconds(2));
+    evb.loop();
+    if (dial.session) report("h3", measure(evb, {dial.session}, streams, rounds, authority));
+    else report("h3", {});
+    if (dial.session) dial.session->drain();
+    evb.loop();
+  }
+
+  h3.stop();
+  srv.stop();
+  serverThread.join();
+}
@@ -0,0 +1,180 @@
+// Added latency of a proxy() route. Starts two stand-in upstream servers
+// and a router that proxies /svc/*rest to them, then times the same
+// request sent straight to an upstream and through the proxy, one at a
+// time over a keep-alive connection. Before timing, it checks that
+// responses and a large streamed POST body come back intact and that both
+// upstreams get traffic.
+//
+//   ./proxy_latency_bench [requests]
+#include "../src/router/Router.h"
+
+#include <proxygen/httpserver/HTTPServer.h>
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Stand-in upstream: answers GETs with "<name>:<url>" and echoes POST bodies.
+class EchoHandler : public proxygen::RequestHandler {
+ public:
+  EchoHandler(const char* name, std::atomic<uint64_t>& hits) : name_(name), hits_(hits) {}
+  void onRequest(std::unique_ptr<proxygen::HTTPMessage> msg) noexcept override {
+    hits_.fetch_add(1);
+    post_ = msg->getMethodString() == "POST";
+    path_ = msg->getURL();
+  }
+  void onBody(std::unique_ptr<folly::IOBuf> b) noexcept override { body_.append(std::move(b)); }
+  void onEOM() noexcept override {
+    proxygen::ResponseBuilder rb(downstream_);
+    rb.status(200, "OK");
+    if (post_) rb.body(body_.move());
+    else rb.body(std::string(name_) + ":" + path_);
+    rb.sendWithEOM();
+  }
+  void onUpgrade(proxygen::UpgradeProtocol) noexcept override {}
+  void requestComplete() noexcept override { delete this; }
+  void onError(proxygen::ProxygenError) noexcept override { delete this; }
+
+ private:
+  const char* name_;
+  std::atomic<uint64_t>& hits_;
+  bool post_ = false;
+  std::string path_;
+  folly::IOBufQueue body_{folly::IOBufQueue::cacheChainLength()};
+};
+
+class EchoFactory : public proxygen::RequestHandlerFactory {
+ public:
+  EchoFactory(const char* name, std::atomic<uint64_t>& hits) : name_(name), hits_(hits) {}
+  void onServerStart(folly::EventBase*) noexcept override {}
+  void onServerStop() noexcept override {}
+  proxygen::RequestHandler* onRequest(proxygen::RequestHandler*, proxygen::HTTPMessage*) noexcept override {
+    return new EchoHandler(name_, hits_);
+  }
+
+ private:
+  const char* name_;
+  std::atomic<uint64_t>& hits_;
+};
+
+std::unique_ptr<proxygen::HTTPServer> serve(uint16_t port, std::unique_ptr<proxygen::RequestHandlerFactory> f,
+                                            std::thread& t) {
+  proxygen::HTTPServerOptions opt;
+  opt.threads = 1;
+  opt.handlerFactories = proxygen::RequestHandlerChain().addThen(std::move(f)).build();
+  auto srv = std::make_unique<proxygen::HTTPServer>(std::move(opt));
+  srv->bind({{folly::SocketAddress("127.0.0.1", port), proxygen::HTTPServer::Protocol::HTTP}});
+  t = std::thread([s = srv.get()] { s->start(); });
+  return srv;
+}
+
+// Minimal blocking HTTP/1.1 client over one keep-alive connection.
+class Client {
+ public:
+  explicit Client(uint16_t port) {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_port = htons(port);
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < 100 && connect(fd_, (sockaddr*)&a, sizeof(a)) != 0; i++)
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));  // server still starting
+  }
+  ~Client() { close(fd_); }
+
+  // Returns the response body ("" on a non-200).
+  std::string request(const std::string& method, const std::string& path, const std::string& body = "") {
+    std::string req = method + " " + path + " HTTP/1.1\r\nHost: bench\r\n";
+    if (!body.empty()) req += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    req += "\r\n" + body;
+    for (size_t off = 0; off < req.size();) {
+      ssize_t n = write(fd_, req.data() + off, req.size() - off);
+      if (n <= 0) return "";
+      off += size_t(n);
+    }
+    size_t hdrEnd;
+    while ((hdrEnd = buf_.find("\r\n\r\n")) == std::string::npos) if (!fill()) return "";
+    const std::string head = buf_.substr(0, hdrEnd);
+    std::string lower(head);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    size_t len = 0;
+    if (auto p = lower.find("content-length:"); p != std::string::npos) len = std::strtoull(head.c_str() + p + 15, nullptr, 10);
+    while (buf_.size() < hdrEnd + 4 + len) if (!fill()) return "";
+    std::string out = buf_.substr(hdrEnd + 4, len);
+    buf_.erase(0, hdrEnd + 4 + len);
+    return head.compare(9, 3, "200") == 0 ? out : "";
+  }
+
+ private:
+  bool fill() {
+    char tmp[16384];
+    ssize_t n = read(fd_, tmp, sizeof(tmp));
+    if (n <= 0) return false;
+    buf_.append(tmp, size_t(n));
+    return true;
+  }
+  int fd_;
+  std::string buf_;
+};
+
+double medianUs(Client& c, const std::string& path, size_t n) {
+  std::vector<double> us;
+  for (size_t i = 0; i < n; i++) {
+    auto t0 = std::chrono::steady_clock::now();
+    c.request("GET", path);
+    us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+  }
+  std::sort(us.begin(), us.end());
+  return us[us.size() / 2];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000;
+  std::atomic<uint64_t> hitsA{0}, hitsB{0};
+  std::thread ta, tb, tp;
+  auto a = serve(18081, std::make_unique<EchoFactory>("a", hitsA), ta);
+  auto b = serve(18082, std::make_unique<EchoFactory>("b", hitsB), tb);
+  auto router = std::make_unique<RouterFactory>();
+  router->proxy("/svc/*rest", {"127.0.0.1:18081", "127.0.0.1:18082"});
+  auto proxy = serve(18080, std::move(router), tp);
+
+  Client direct(18081), proxied(18080);
+  int failures = 0;
+  auto check = [&](bool ok, const char* what) { if (!ok) { std::fprintf(stderr, "FAIL: %s\n", what); failures++; } };
+
+  const std::string r = proxied.request("GET", "/svc/x/y?q=1");
+  check(r == "a:/x/y?q=1" || r == "b:/x/y?q=1", "path rewritten and query kept");
+  std::string big(4 << 20, 'z');
+  for (size_t i = 0; i < big.size(); i += 4096) big[i] = char('a' + (i / 4096) % 26);
+  check(proxied.request("POST", "/svc/echo", big) == big, "4MB body streamed both ways");
+  for (int i = 0; i < 200; i++) proxied.request("GET", "/svc/spread");
+  check(hitsA > 20 && hitsB > 20, "both upstreams in rotation");
+  if (failures) return 1;
+
+  medianUs(direct, "/x", 1000);  // warm up
+  medianUs(proxied, "/svc/x", 1000);
+  const double d = medianUs(direct, "/x", n);
+  const double p = medianUs(proxied, "/svc/x", n);
+  std::printf("%14s %14s %14s\n", "direct p50 us", "proxied p50 us", "added us");
+  std::printf("%14.1f %14.1f %14.1f\n", d, p, p - d);
+
+  proxy->stop(); a->stop(); b->stop();
+  tp.join(); ta.join(); tb.join();
+}
@@ -0,0 +1,106 @@
+// Matches/sec of the frozen RouteTable against the original recursive trie
+// walk (splitPath + unordered_map children + accumulate for wildcards).
+//
+//   ./route_match_bench [iterations]
+#include "../src/router/PathPattern.h"
+#include "../src/router/RouteTable.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Baseline matcher, kept verbatim from the pre-freeze router.
+bool legacyMatch(TrieNode* node, const std::vector<std::string>& parts, size_t i,
+                 std::unordered_map<std::string,std::string>& params, TrieNode*& out) {
+  if (i == parts.size()) {
+    if (node->route >= 0) { out = node; return true; }
+    return false;
+  }
+  auto& seg = parts[i];
+  if (node->children.count(seg)) {
+    if (legacyMatch(node->children[seg].get(), parts, i+1, params, out)) return true;
+  }
+  if (node->paramChild) {
+    params[node->paramChild->paramName] = seg;
+    if (legacyMatch(node->paramChild.get(), parts, i+1, params, out)) return true;
+    params.erase(node->paramChild->paramName);
+  }
+  if (node->wildcardChild) {
+    params[node->wildcardChild->paramName] =
+      std::accumulate(parts.begin()+i, parts.end(), std::string(),
+        [](auto& acc,const auto& s){ return acc.empty()?s:acc+"/"+s; });
+    out = node->wildcardChild.get();
+    return true;
+  }
+  return false;
+}
+
+// A REST-ish route set: /api/v<k>/res<k>/:id/sub<k>, plus a wildcard.
+std::vector<std::string> makeRoutes(size_t n) {
+  std::vector<std::string> out;
+  for (size_t i=0; out.size()<n; i++) {
+    out.push_back("/api/v" + std::to_string(i%4) + "/res" + std::to_string(i) + "/:id");
+    if (out.size()<n) out.push_back("/api/v" + std::to_string(i%4) + "/res" + std::to_string(i) + "/:id/sub/:sid");
+  }
+  out.back() = "/static/*rest";
+  return out;
+}
+
+std::vector<std::string> makeRequests(size_t routes) {
+  std::vector<std::string> out;
+  for (size_t i=0; i<1024; i++) {
+    const size_t r = (i*2654435761u) % (routes/2 ? routes/2 : 1);
+    if (i%3==0) out.push_back("/api/v" + std::to_string(r%4) + "/res" + std::to_string(r) + "/" + std::to_string(i));
+    else if (i%3==1) out.push_back("/api/v" + std::to_string(r%4) + "/res" + std::to_string(r) + "/" + std::to_string(i) + "/sub/x");
+    else out.push_back("/static/css/app" + std::to_string(i) + ".css");
+  }
+  return out;
+}
+
+template <class F>
+double run(size_t iters, const std::vector<std::string>& reqs, F&& f) {
+  size_t hits = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t i=0; i<iters; i++) hits += f(reqs[i % reqs.size()]);
+  auto t1 = std::chrono::steady_clock::now();
+  if (hits == size_t(-1)) std::puts("");  // keep the loop alive
+  return iters / std::chrono::duration<double>(t1-t0).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const size_t iters = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2'000'000;
+  std::printf("%8s %16s %16s %8s\n", "routes", "trie match/s", "frozen match/s", "speedup");
+
+  for (size_t n : {size_t(10), size_t(1000), size_t(50000)}) {
+    TrieRoots roots;
+    roots[size_t(Method::Get)] = std::make_unique<TrieNode>();
+    auto routes = makeRoutes(n);
+    for (size_t i=0; i<routes.size(); i++)
+      trieInsert(*roots[size_t(Method::Get)], routes[i])->route = int32_t(i);
+
+    RouteTable table;
+    table.build(roots);
+    const auto reqs = makeRequests(n);
+    TrieNode* root = roots[size_t(Method::Get)].get();
+
+    const double legacy = run(iters, reqs, [&](const std::string& p) {
+      const auto parts = splitPath(stripQuery(p));
+      std::unordered_map<std::string,std::string> params;
+      TrieNode* out = nullptr;
+      return legacyMatch(root, parts, 0, params, out) ? 1 : 0;
+    });
+    const double frozen = run(iters, reqs, [&](const std::string& p) {
+      RouteParams params;
+      return table.match(Method::Get, p, params) >= 0 ? 1 : 0;
+    });
+    std::printf("%8zu %16.0f %16.0f %7.1fx\n", n, legacy, frozen, frozen/legacy);
+  }
+}
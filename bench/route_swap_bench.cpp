@@ -0,0 +1,110 @@
+// Lookups/sec through a Published<RouteTable> (pin + match per lookup, as
+// onRequest does) with N reader threads, first with no writer and then with
+// a writer that rebuilds and publishes a new table as fast as it can,
+// adding and removing a route each time. Throughput is per second of
+// reader CPU time, so a writer competing for cores does not count against
+// the read path.
+//
+//   ./route_swap_bench [readers] [seconds]
+#include "../src/router/Published.h"
+#include "../src/router/RouteTable.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+double threadCpuSeconds() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+std::vector<std::string> makeRoutes(size_t n) {
+  std::vector<std::string> out;
+  for (size_t i=0; i<n; i++)
+    out.push_back("/api/v" + std::to_string(i%4) + "/res" + std::to_string(i) + "/:id");
+  return out;
+}
+
+std::shared_ptr<const RouteTable> build(const std::vector<std::string>& routes, size_t extra) {
+  TrieRoots roots;
+  roots[size_t(Method::Get)] = std::make_unique<TrieNode>();
+  for (size_t i=0; i<routes.size(); i++)
+    trieInsert(*roots[size_t(Method::Get)], routes[i])->route = int32_t(i);
+  // The churned route: a different one every publish.
+  trieInsert(*roots[size_t(Method::Get)], "/churn/" + std::to_string(extra))->route = int32_t(routes.size());
+  auto t = std::make_shared<RouteTable>();
+  t->build(roots);
+  return t;
+}
+
+struct Result { double lookups; uint64_t publishes; };  // lookups: per reader CPU-second x readers
+
+Result run(Published<RouteTable>& table, const std::vector<std::string>& routes,
+           size_t readers, double seconds, bool churn) {
+  std::vector<std::string> reqs;
+  for (size_t i=0; i<1024; i++) {
+    const size_t r = (i*2654435761u) % routes.size();
+    reqs.push_back("/api/v" + std::to_string(r%4) + "/res" + std::to_string(r) + "/" + std::to_string(i));
+  }
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> total{0}, publishes{0};
+  std::atomic<double> cpu{0};
+  std::vector<std::thread> threads;
+  for (size_t t=0; t<readers; t++) {
+    threads.emplace_back([&, t] {
+      uint64_t n = 0, hits = 0;
+      const double c0 = threadCpuSeconds();
+      for (size_t i=t; !stop.load(std::memory_order_relaxed); i++, n++) {
+        auto snap = table.pin();
+        RouteParams params;
+        hits += snap->match(Method::Get, reqs[i % reqs.size()], params) >= 0;
+      }
+      if (hits != n) std::fprintf(stderr, "missed lookups\n");
+      total.fetch_add(n);
+      const double c = threadCpuSeconds() - c0;
+      for (double cur = cpu.load(); !cpu.compare_exchange_weak(cur, cur + c);) {}
+    });
+  }
+  std::thread writer;
+  if (churn) {
+    writer = std::thread([&] {
+      for (size_t i=1; !stop.load(std::memory_order_relaxed); i++) {
+        table.publish(build(routes, i));
+        publishes.fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+  }
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (auto& t : threads) t.join();
+  if (writer.joinable()) writer.join();
+  return {total.load() / cpu.load() * readers, publishes.load()};
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const size_t readers = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4;
+  const double seconds = argc > 2 ? std::atof(argv[2]) : 2.0;
+  const auto routes = makeRoutes(1000);
+
+  Published<RouteTable> table;
+  table.publish(build(routes, 0));
+
+  const Result quiet = run(table, routes, readers, seconds, false);
+  const Result churn = run(table, routes, readers, seconds, true);
+  std::printf("%8s %16s %16s %10s %12s\n", "readers", "quiet lookup/s", "churn lookup/s", "ratio", "publishes/s");
+  std::printf("%8zu %16.0f %16.0f %9.2fx %12.0f\n", readers, quiet.lookups, churn.lookups,
+              churn.lookups / quiet.lookups, churn.publishes / seconds);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <folly/futures/Future.h>
+#include <sodium.h>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+#include "../router/Metrics.h"
+#include "../router/WorkerPool.h"
+
+// Argon2id password hashing (libsodium crypto_pwhash). Each hash costs tens
+// of milliseconds of CPU and `memLimit` bytes of RAM, so it runs on its own
+// small pool with a bounded queue: a signup/login storm queues here (and
+// gets 503 once the queue is full) instead of eating IO threads or the
+// request worker pools. Reports password_hash_seconds plus the usual
+// hash_pool_* queue series.
+class PasswordHasher {
+ public:
+  struct Options {
+    size_t threads = 2;
+    size_t maxQueue = 64;
+    unsigned long long opsLimit = crypto_pwhash_OPSLIMIT_INTERACTIVE;
+    size_t memLimit = crypto_pwhash_MEMLIMIT_INTERACTIVE;
+  };
+
+  PasswordHasher() : PasswordHasher(Options{}) {}
+  explicit PasswordHasher(Options o, Metrics* metrics = nullptr)
+      : opts_(o), pool_("hash", o.threads, o.maxQueue, metrics) {
+    if (sodium_init() < 0) throw std::runtime_error("sodium_init failed");
+    if (metrics) latency_ = &metrics->histogram("password_hash_seconds");
+  }
+
+  // PHC-encoded string ($argon2id$v=19$m=...,t=...,p=1$salt$hash); the
+  // parameters travel with it, so hashes stay verifiable if Options change.
+  folly::SemiFuture<std::string> hash(std::string password) {
+    return pool_.submit([this, pw = std::move(password)]() mutable {
+      const auto t0 = std::chrono::steady_clock::now();
+      char out[crypto_pwhash_STRBYTES];
+      const int rc = crypto_pwhash_str(out, pw.data(), pw.size(), opts_.opsLimit, opts_.memLimit);
+      sodium_memzero(pw.data(), pw.size());
+      observe(t0);
+      if (rc != 0) throw std::runtime_error("crypto_pwhash_str: out of memory");
+      return std::string(out);
+    });
+  }
+
+  folly::SemiFuture<bool> verify(std::string encoded, std::string password) {
+    return pool_.submit([this, encoded = std::move(encoded), pw = std::move(password)]() mutable {
+      const auto t0 = std::chrono::steady_clock::now();
+      const bool ok = crypto_pwhash_str_verify(encoded.c_str(), pw.data(), pw.size()) == 0;
+      sodium_memzero(pw.data(), pw.size());
+      observe(t0);
+      return ok;
+    });
+  }
+
+  // True if `encoded` was made with weaker parameters than the current
+  // Options; rehash on the next successful login.
+  bool needsRehash(const std::string& encoded) const {
+    return crypto_pwhash_str_needs_rehash(encoded.c_str(), opts_.opsLimit, opts_.memLimit) != 0;
+  }
+
+ private:
+  void observe(std::chrono::steady_clock::time_point t0) {
+    if (!latency_) return;
+    latency_->record(uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - t0).count()));
+  }
+
+  Options opts_;
+  LatencyHistogram* latency_ = nullptr;
+  WorkerPool pool_;  // last: joined before the rest goes away
+};
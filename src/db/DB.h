@@ -1,32 +1,205 @@
 #pragma once
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/executors/thread_factory/NamedThreadFactory.h>
+#include <folly/futures/Future.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <pqxx/pqxx>
-#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
+#include "../router/Metrics.h"
+
+// Fixed-size connection pool. acquire() never blocks the caller: when every
+// connection is out, the request waits in a FIFO queue until one is
+// released or its timeout fires (folly::FutureTimeout). Connections come back
+// through Lease's destructor, so an exception in a query cannot leak one.
+//
+// pqxx is synchronous, so queries run on the pool's own executor (one
+// thread per connection) via run(); callers get a SemiFuture and choose
+// where to continue (the router resumes on the request's EventBase).
+//
+// Statements registered with prepare() are prepared on every connection
+// before run() hands it out, including connections reopened after a drop,
+// so services call them by name (pqxx::prepped) and skip the per-call
+// parse/plan.
 class DBPool {
-public:
-  DBPool(const std::string &conninfo, size_t size = 4) {
+ private:
+  struct Conn {
+    explicit Conn(const std::string& conninfo) : pq(std::make_unique<pqxx::connection>(conninfo)) {}
+    std::unique_ptr<pqxx::connection> pq;
+    size_t prepared = 0;  // statements_[0, prepared) are prepared on pq
+  };
+
+ public:
+  class Lease {
+   public:
+    Lease() = default;
+    Lease(Lease&& o) noexcept : pool_(o.pool_), conn_(std::move(o.conn_)) { o.pool_ = nullptr; }
+    Lease& operator=(Lease&& o) noexcept {
+      if (this != &o) { reset(); pool_ = o.pool_; conn_ = std::move(o.conn_); o.pool_ = nullptr; }
+      return *this;
+    }
+    ~Lease() { reset(); }
+
+    pqxx::connection& operator*() const { return *conn_->pq; }
+    pqxx::connection* operator->() const { return conn_->pq.get(); }
+
+   private:
+    friend class DBPool;
+    Lease(DBPool* p, std::unique_ptr<Conn> c) : pool_(p), conn_(std::move(c)) {}
+    void reset() {
+      if (pool_ && conn_) pool_->release(std::move(conn_));
+      pool_ = nullptr;
+    }
+
+    DBPool* pool_ = nullptr;
+    std::unique_ptr<Conn> conn_;
+  };
+
+  DBPool(const std::string& conninfo, size_t size = 4, Metrics* metrics = nullptr)
+      : conninfo_(conninfo), executor_(std::make_unique<folly::CPUThreadPoolExecutor>(
+            size, std::make_shared<folly::NamedThreadFactory>("DBPool"))) {
     for (size_t i = 0; i < size; i++) {
-      pool_.push(std::make_shared<pqxx::connection>(conninfo));
+      idle_.push_back(std::make_unique<Conn>(conninfo));
+    }
+    if (metrics) {
+      waitHist_ = &metrics->histogram("db_pool_wait_seconds");
+      inUse_ = &metrics->gauge("db_pool_in_use");
+      waiters_ = &metrics->gauge("db_pool_waiters");
+      timeouts_ = &metrics->counter("db_pool_timeouts_total");
+      metrics->gauge("db_pool_size").store(int64_t(size), std::memory_order_relaxed);
     }
   }
+  DBPool(const DBPool&) = delete;
+  DBPool& operator=(const DBPool&) = delete;
 
-  std::shared_ptr<pqxx::connection> acquire() {
-    std::lock_guard<std::mutex> lk(mu_);
-    if (pool_.empty())
-      throw std::runtime_error("No DB connections available");
-    auto c = pool_.front();
-    pool_.pop();
-    return c;
+  // Ready immediately if a connection is idle; otherwise completes when one
+  // is handed over, or fails with folly::FutureTimeout after `timeout`.
+  folly::SemiFuture<Lease> acquire(std::chrono::milliseconds timeout = std::chrono::milliseconds(1000)) {
+    std::unique_lock<std::mutex> lk(mu_);
+    if (!idle_.empty()) {
+      auto c = std::move(idle_.back());
+      idle_.pop_back();
+      lk.unlock();
+      gaugeAdd(inUse_, 1);
+      observeWait(std::chrono::steady_clock::duration::zero());
+      return folly::makeSemiFuture(Lease(this, std::move(c)));
+    }
+    auto w = std::make_shared<Waiter>();
+    w->since = std::chrono::steady_clock::now();
+    auto f = w->promise.getSemiFuture();
+    waiting_.push_back(w);
+    lk.unlock();
+    gaugeAdd(waiters_, 1);
+
+    folly::futures::sleep(timeout).toUnsafeFuture().thenValue([this, w](folly::Unit) {
+      {
+        std::lock_guard<std::mutex> g(mu_);
+        if (w->done) return;
+        w->done = true;
+        waiting_.erase(std::find(waiting_.begin(), waiting_.end(), w));
+      }
+      gaugeAdd(waiters_, -1);
+      if (timeouts_) timeouts_->fetch_add(1, std::memory_order_relaxed);
+      w->promise.setException(folly::FutureTimeout());
+    });
+    return f;
   }
 
-  void release(std::shared_ptr<pqxx::connection> c) {
+  // Registers a named statement. Safe to call at any time; connections pick
+  // it up the next time they are leased through run(). Re-registering a
+  // name is an error (pqxx refuses to prepare it twice).
+  void prepare(std::string name, std::string sql) {
     std::lock_guard<std::mutex> lk(mu_);
-    pool_.push(std::move(c));
+    for (auto& st : statements_)
+      if (st.name == name) throw std::invalid_argument("statement already registered: " + name);
+    statements_.push_back({std::move(name), std::move(sql)});
   }
 
-private:
-  std::queue<std::shared_ptr<pqxx::connection>> pool_;
+  // Runs fn(pqxx::connection&) on the pool executor with a leased
+  // connection; the lease is returned as soon as fn finishes or throws.
+  template <class F>
+  auto run(F fn, std::chrono::milliseconds timeout = std::chrono::milliseconds(1000)) {
+    return acquire(timeout)
+      .via(executor_.get())
+      .thenValue([this, fn = std::move(fn)](Lease l) mutable {
+        ready(*l.conn_);
+        return fn(*l);
+      })
+      .semi();
+  }
+
+ private:
+  struct Statement { std::string name, sql; };
+
+  // Reopens a dropped connection and prepares whatever it is missing. Runs
+  // on the pool executor.
+  void ready(Conn& c) {
+    if (!c.pq->is_open()) {
+      c.pq = std::make_unique<pqxx::connection>(conninfo_);
+      c.prepared = 0;
+    }
+    std::vector<Statement> missing;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      missing.assign(statements_.begin() + c.prepared, statements_.end());
+    }
+    for (auto& st : missing) {
+      c.pq->prepare(st.name, st.sql);
+      c.prepared++;
+    }
+  }
+
+  struct Waiter {
+    folly::Promise<Lease> promise;
+    std::chrono::steady_clock::time_point since;
+    bool done = false;  // guarded by mu_
+  };
+
+  // Hands the connection straight to the oldest waiter, or parks it.
+  void release(std::unique_ptr<Conn> c) {
+    std::shared_ptr<Waiter> w;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      if (waiting_.empty()) {
+        idle_.push_back(std::move(c));
+      } else {
+        w = std::move(waiting_.front());
+        waiting_.pop_front();
+        w->done = true;
+      }
+    }
+    if (!w) { gaugeAdd(inUse_, -1); return; }
+    gaugeAdd(waiters_, -1);
+    observeWait(std::chrono::steady_clock::now() - w->since);
+    w->promise.setValue(Lease(this, std::move(c)));
+  }
+
+  void observeWait(std::chrono::steady_clock::duration d) {
+    if (waitHist_)
+      waitHist_->record(uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(d).count()));
+  }
+  static void gaugeAdd(std::atomic<int64_t>* g, int64_t n) {
+    if (g) g->fetch_add(n, std::memory_order_relaxed);
+  }
+
+  const std::string conninfo_;
   std::mutex mu_;
+  std::vector<std::unique_ptr<Conn>> idle_;
+  std::vector<Statement> statements_;  // append-only
+  std::deque<std::shared_ptr<Waiter>> waiting_;
+
+  LatencyHistogram* waitHist_ = nullptr;
+  std::atomic<int64_t>* inUse_ = nullptr;
+  std::atomic<int64_t>* waiters_ = nullptr;
+  std::atomic<uint64_t>* timeouts_ = nullptr;
+
+  // Declared last: destroyed (and joined) first, while the connections and
+  // the mutex are still alive for any query that is finishing.
+  std::unique_ptr<folly::CPUThreadPoolExecutor> executor_;
 };
@@ -0,0 +1,139 @@
+#pragma once
+#include <folly/futures/Future.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DB.h"
+#include "../router/Metrics.h"
+
+// Group commit for user inserts. Concurrent registrations are collected
+// for up to `window` or `maxRows` rows, whichever comes first, and written
+// with one multi-row INSERT in one transaction: one round trip and one WAL
+// flush per batch instead of per user. Each caller still gets its own
+// result. Rows that hit a unique constraint are skipped by
+// ON CONFLICT DO NOTHING and reported as Duplicate; they do not fail the
+// rest of the batch.
+class RegistrationBatcher {
+ public:
+  struct Options {
+    std::chrono::milliseconds window{2};
+    size_t maxRows = 256;
+  };
+
+  struct Row { std::string username, password, email; };  // password: PHC hash
+
+  struct Result {
+    enum class Status { Created, Duplicate, Failed };
+    Status status;
+    int id = 0;  // Created only
+  };
+
+  static constexpr const char* kInsertBatch = "users_insert_batch";
+
+  RegistrationBatcher(DBPool& pool, Options o, Metrics* metrics = nullptr)
+      : pool_(pool), opts_(o) {
+    pool_.prepare(kInsertBatch,
+      "INSERT INTO users (username, password, email) "
+      "SELECT * FROM unnest($1::text[], $2::text[], $3::text[]) "
+      "ON CONFLICT DO NOTHING RETURNING id, username");
+    if (metrics) {
+      batches_ = &metrics->counter("db_register_batches_total");
+      rows_ = &metrics->counter("db_register_rows_total");
+    }
+  }
+  RegistrationBatcher(const RegistrationBatcher&) = delete;
+  RegistrationBatcher& operator=(const RegistrationBatcher&) = delete;
+
+  folly::SemiFuture<Result> add(Row row) {
+    folly::Promise<Result> p;
+    auto f = p.getSemiFuture();
+    std::unique_ptr<Batch> full;
+    bool first = false;
+    uint64_t gen;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      if (!pending_) pending_ = std::make_unique<Batch>();
+      first = pending_->rows.empty();
+      pending_->rows.push_back(std::move(row));
+      pending_->promises.push_back(std::move(p));
+      gen = gen_;
+      if (pending_->rows.size() >= opts_.maxRows) { full = std::move(pending_); gen_++; }
+    }
+    if (full) {
+      flush(std::move(full));
+    } else if (first) {
+      folly::futures::sleep(opts_.window).toUnsafeFuture().thenValue([this, gen](folly::Unit) {
+        std::unique_ptr<Batch> b;
+        {
+          std::lock_guard<std::mutex> lk(mu_);
+          if (gen_ != gen || !pending_) return;  // already flushed as full
+          b = std::move(pending_);
+          gen_++;
+        }
+        flush(std::move(b));
+      });
+    }
+    return f;
+  }
+
+ private:
+  struct Batch {
+    std::vector<Row> rows;
+    std::vector<folly::Promise<Result>> promises;
+  };
+
+  void flush(std::unique_ptr<Batch> b) {
+    if (batches_) batches_->fetch_add(1, std::memory_order_relaxed);
+    if (rows_) rows_->fetch_add(b->rows.size(), std::memory_order_relaxed);
+    std::shared_ptr<Batch> batch(std::move(b));
+    pool_.run([batch](pqxx::connection& conn) { return insert(conn, batch->rows); })
+      .toUnsafeFuture()
+      .thenTry([batch](folly::Try<std::vector<Result>>&& t) {
+        for (size_t i = 0; i < batch->promises.size(); i++) {
+          if (t.hasException()) batch->promises[i].setException(t.exception());
+          else batch->promises[i].setValue((*t)[i]);
+        }
+      });
+  }
+
+  static std::vector<Result> insert(pqxx::connection& conn, const std::vector<Row>& rows) {
+    std::vector<std::string> users, passwords, emails;
+    users.reserve(rows.size()); passwords.reserve(rows.size()); emails.reserve(rows.size());
+    for (auto& r : rows) {
+      users.push_back(r.username);
+      passwords.push_back(r.password);
+      emails.push_back(r.email);
+    }
+    std::vector<Result> out(rows.size(), Result{Result::Status::Failed});
+    try {
+      pqxx::work txn(conn);
+      auto res = txn.exec(pqxx::prepped{kInsertBatch}, pqxx::params(users, passwords, emails));
+      txn.commit();
+      // RETURNING has no row order; match inserted rows back by username.
+      // A name repeated within the batch goes to its first caller.
+      std::unordered_map<std::string, int> ids;
+      for (auto row : res) ids.emplace(row[1].as<std::string>(), row[0].as<int>());
+      for (size_t i = 0; i < rows.size(); i++) {
+        auto it = ids.find(rows[i].username);
+        if (it == ids.end()) { out[i].status = Result::Status::Duplicate; continue; }
+        out[i] = Result{Result::Status::Created, it->second};
+        ids.erase(it);
+      }
+    } catch (const pqxx::failure&) {
+      // Leave the whole batch as Failed, as a single INSERT would have.
+    }
+    return out;
+  }
+
+  DBPool& pool_;
+  Options opts_;
+  std::mutex mu_;
+  std::unique_ptr<Batch> pending_;
+  uint64_t gen_ = 0;  // bumped whenever pending_ is taken for a flush
+  std::atomic<uint64_t>* batches_ = nullptr;
+  std::atomic<uint64_t>* rows_ = nullptr;
+};
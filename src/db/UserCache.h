@@ -0,0 +1,171 @@
+#pragma once
+#include <folly/io/IOBuf.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../router/Metrics.h"
+
+// Read-through cache for user lookups, keyed by id. Values are the response
+// body already serialized to JSON, so a hit is an IOBuf clone (a refcount
+// bump): no query and no nlohmann round trip. Ids that do not exist are
+// cached too, with a shorter TTL.
+//
+// Split into independently locked shards; each is bounded and evicts with
+// CLOCK (a hit sets the entry's reference bit, the hand clears bits until it
+// finds an unreferenced victim).
+//
+// Fills race with writes: a lookup that read the database before a write
+// committed must not cache what it read after the write's invalidate(). So
+// readers take generation(id) before querying and pass it to put(), which
+// drops the value if the shard has been invalidated since.
+class UserCache {
+ public:
+  struct Options {
+    size_t capacity = 100'000;  // entries across all shards
+    size_t shards = 16;
+    std::chrono::milliseconds ttl{30'000};
+    std::chrono::milliseconds negativeTtl{2'000};
+  };
+
+  struct Hit {
+    std::unique_ptr<folly::IOBuf> json;
+    bool found;
+  };
+
+  UserCache() : UserCache(Options{}) {}
+  explicit UserCache(Options o, Metrics* metrics = nullptr)
+      : opts_(o), shards_(std::max<size_t>(o.shards, 1)) {
+    perShard_ = std::max<size_t>(opts_.capacity / shards_.size(), 1);
+    if (metrics) {
+      hits_ = &metrics->counter("user_cache_hits_total");
+      misses_ = &metrics->counter("user_cache_misses_total");
+      evictions_ = &metrics->counter("user_cache_evictions_total");
+    }
+  }
+  UserCache(const UserCache&) = delete;
+  UserCache& operator=(const UserCache&) = delete;
+
+  std::optional<Hit> get(int id) {
+    const auto now = Clock::now();
+    Shard& s = shardFor(id);
+    {
+      std::lock_guard<std::mutex> lk(s.mu);
+      auto it = s.index.find(id);
+      if (it != s.index.end()) {
+        Slot& e = s.slots[it->second];
+        if (e.expires > now) {
+          e.referenced = true;
+          count(hits_);
+          return Hit{e.json->clone(), e.found};
+        }
+        s.drop(it->second);
+      }
+    }
+    count(misses_);
+    return std::nullopt;
+  }
+
+  // Invalidation epoch of the shard holding `id`; take it before reading
+  // the value that will be put().
+  uint64_t generation(int id) {
+    return shardFor(id).generation.load(std::memory_order_acquire);
+  }
+
+  // `json` is the exact response body; `found` = false marks a negative
+  // entry (short TTL). Ignored if `id`'s shard was invalidated after
+  // `generation` was taken: the value may predate that write.
+  void put(int id, const std::string& json, bool found, uint64_t generation) {
+    auto buf = folly::IOBuf::copyBuffer(json);
+    const auto expires = Clock::now() + (found ? opts_.ttl : opts_.negativeTtl);
+    Shard& s = shardFor(id);
+    std::lock_guard<std::mutex> lk(s.mu);
+    if (s.generation.load(std::memory_order_relaxed) != generation) return;
+    auto it = s.index.find(id);
+    uint32_t i;
+    if (it != s.index.end()) {
+      i = it->second;
+    } else {
+      i = s.claim(perShard_, evictions_);
+      s.index.emplace(id, i);
+    }
+    Slot& e = s.slots[i];
+    e.id = id;
+    e.json = std::move(buf);
+    e.expires = expires;
+    e.found = found;
+    e.live = true;
+    e.referenced = false;
+  }
+
+  // Write paths call this for every id they create, change or delete.
+  void invalidate(int id) {
+    Shard& s = shardFor(id);
+    std::lock_guard<std::mutex> lk(s.mu);
+    s.generation.fetch_add(1, std::memory_order_release);
+    auto it = s.index.find(id);
+    if (it != s.index.end()) s.drop(it->second);
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Slot {
+    int id = 0;
+    std::unique_ptr<folly::IOBuf> json;
+    Clock::time_point expires;
+    bool found = false;
+    bool live = false;
+    bool referenced = false;
+  };
+
+  struct alignas(64) Shard {
+    std::mutex mu;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free;
+    std::unordered_map<int, uint32_t> index;
+    size_t hand = 0;
+    std::atomic<uint64_t> generation{0};  // bumped by invalidate(), under mu
+
+    void drop(uint32_t i) {
+      Slot& e = slots[i];
+      index.erase(e.id);
+      e.json.reset();
+      e.live = false;
+      free.push_back(i);
+    }
+
+    // A slot for a new entry: a free one, a fresh one while under capacity,
+    // or the CLOCK victim.
+    uint32_t claim(size_t capacity, std::atomic<uint64_t>* evictions) {
+      if (!free.empty()) { uint32_t i = free.back(); free.pop_back(); return i; }
+      if (slots.size() < capacity) { slots.emplace_back(); return uint32_t(slots.size() - 1); }
+      for (;;) {
+        Slot& e = slots[hand];
+        const uint32_t i = uint32_t(hand);
+        hand = (hand + 1) % slots.size();
+        if (e.referenced) { e.referenced = false; continue; }
+        index.erase(e.id);
+        count(evictions);
+        return i;
+      }
+    }
+  };
+
+  Shard& shardFor(int id) { return shards_[std::hash<int>{}(id) % shards_.size()]; }
+  static void count(std::atomic<uint64_t>* c) { if (c) c->fetch_add(1, std::memory_order_relaxed); }
+
+  Options opts_;
+  size_t perShard_;
+  std::vector<Shard> shards_;
+  std::atomic<uint64_t>* hits_ = nullptr;
+  std::atomic<uint64_t>* misses_ = nullptr;
+  std::atomic<uint64_t>* evictions_ = nullptr;
+};
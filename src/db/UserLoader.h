@@ -0,0 +1,128 @@
+#pragma once
+#include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/EventBaseLocal.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <unordered_map>
+#include <vector>
+
+#include "DB.h"
+#include "../router/Metrics.h"
+
+// DataLoader for user rows. Every id asked for on an EventBase during one
+// loop iteration goes out as a single `WHERE id = ANY($1)` query at the end
+// of that iteration, and results are fanned back on the same EventBase.
+// Concurrent loads of the same id share one promise, whether the id is
+// still pending or already in flight (singleflight).
+//
+// Called off an EventBase thread, a load is sent right away on its own.
+class UserLoader {
+ public:
+  static constexpr const char* kUsersByIds = "users_by_ids";
+
+  explicit UserLoader(DBPool& pool, Metrics* metrics = nullptr) : pool_(pool) {
+    pool_.prepare(kUsersByIds, "SELECT id, username, email FROM users WHERE id = ANY($1::int[])");
+    if (metrics) {
+      batches_ = &metrics->counter("user_loader_batches_total");
+      keys_ = &metrics->counter("user_loader_keys_total");
+      coalesced_ = &metrics->counter("user_loader_coalesced_total");
+    }
+  }
+  UserLoader(const UserLoader&) = delete;
+  UserLoader& operator=(const UserLoader&) = delete;
+
+  // The user object, or {"error":"not_found"}.
+  folly::SemiFuture<nlohmann::json> load(int id) {
+    folly::EventBase* evb = folly::EventBaseManager::get()->getExistingEventBase();
+    if (!evb) {
+      auto one = std::make_shared<Waiters>();
+      auto f = (*one)[id].getSemiFuture();
+      dispatch(nullptr, std::move(one));
+      return f;
+    }
+
+    State& st = state_.try_emplace(*evb);
+    if (auto it = st.inflight.find(id); it != st.inflight.end()) {
+      count(coalesced_);
+      return it->second->getSemiFuture();
+    }
+    auto [it, fresh] = st.pending.try_emplace(id);
+    if (!fresh) {
+      count(coalesced_);
+      return it->second.getSemiFuture();
+    }
+    if (!st.scheduled) {
+      st.scheduled = true;
+      evb->runInLoop([this, evb] { flush(*evb); });
+    }
+    return it->second.getSemiFuture();
+  }
+
+ private:
+  using Waiters = std::unordered_map<int, folly::SharedPromise<nlohmann::json>>;
+
+  struct State {
+    Waiters pending;  // not sent yet
+    // Sent, keyed into the batch that carries the id.
+    std::unordered_map<int, folly::SharedPromise<nlohmann::json>*> inflight;
+    bool scheduled = false;
+  };
+
+  void flush(folly::EventBase& evb) {
+    State& st = state_.try_emplace(evb);
+    st.scheduled = false;
+    if (st.pending.empty()) return;
+    auto batch = std::make_shared<Waiters>(std::move(st.pending));
+    st.pending.clear();
+    for (auto& [id, p] : *batch) st.inflight.emplace(id, &p);
+    dispatch(&evb, std::move(batch));
+  }
+
+  // Runs the query for every id in `batch` and completes the promises, on
+  // `evb` when there is one.
+  void dispatch(folly::EventBase* evb, std::shared_ptr<Waiters> batch) {
+    count(batches_);
+    if (keys_) keys_->fetch_add(batch->size(), std::memory_order_relaxed);
+    std::vector<int> ids;
+    ids.reserve(batch->size());
+    for (auto& kv : *batch) ids.push_back(kv.first);
+
+    auto rows = pool_.run([ids = std::move(ids)](pqxx::connection& conn) {
+      pqxx::work txn(conn);
+      auto r = txn.exec(pqxx::prepped{kUsersByIds}, pqxx::params(ids));
+      txn.commit();
+      std::unordered_map<int, nlohmann::json> found;
+      for (auto row : r) {
+        const int id = row["id"].as<int>();
+        found.emplace(id, nlohmann::json{{"id", id},
+                                         {"username", row["username"].as<std::string>()},
+                                         {"email", row["email"].as<std::string>()}});
+      }
+      return found;
+    });
+
+    auto done = [this, evb, batch](folly::Try<std::unordered_map<int, nlohmann::json>>&& t) {
+      State* st = evb ? &state_.try_emplace(*evb) : nullptr;
+      for (auto& [id, p] : *batch) {
+        if (st) st->inflight.erase(id);
+        if (t.hasException()) { p.setException(t.exception()); continue; }
+        auto it = t->find(id);
+        p.setValue(it != t->end() ? std::move(it->second)
+                                  : nlohmann::json::object({{"error", "not_found"}}));
+      }
+    };
+    if (evb) std::move(rows).via(evb).thenTry(std::move(done));
+    else std::move(rows).toUnsafeFuture().thenTry(std::move(done));
+  }
+
+  static void count(std::atomic<uint64_t>* c) { if (c) c->fetch_add(1, std::memory_order_relaxed); }
+
+  DBPool& pool_;
+  folly::EventBaseLocal<State> state_;
+  std::atomic<uint64_t>* batches_ = nullptr;
+  std::atomic<uint64_t>* keys_ = nullptr;
+  std::atomic<uint64_t>* coalesced_ = nullptr;
+};
@@ -1,45 +1,85 @@
 #pragma once
-#include <iostream>
+#include <folly/futures/Future.h>
+#include <optional>
+#include <vector>
 #include <nlohmann/json.hpp>
 
 #include "DB.h"
+#include "../auth/PasswordHasher.h"
+#include "RegistrationBatcher.h"
+#include "UserCache.h"
+#include "UserLoader.h"
 
+// Queries run on the DBPool executor; results come back as SemiFutures so
+// the caller never blocks its EventBase. With a UserCache, lookups are read
+// through it and registrations invalidate the id they create. Passwords are
+// stored as Argon2id hashes computed on the PasswordHasher's pool.
 class UserService {
  public:
-  explicit UserService(DBPool& pool) : pool_(pool) {}
-
-  std::string registerUser(const std::string& username, const std::string& password, const std::string& email) {
-    try {
-      auto conn = pool_.acquire();
-      pqxx::work txn(*conn);
-      auto r = txn.exec("INSERT INTO users (username, password, email) VALUES ($1,$2,$3)", pqxx::params(username, password, email));
-      txn.commit();
-      pool_.release(conn);
-      return "success";
-    } catch (...) {
-      std::cout << "Error" << std::endl;
-      return "false";
-    }
+  using RegisterResult = RegistrationBatcher::Result;
+
+  UserService(DBPool& pool, PasswordHasher& hasher, UserCache* cache = nullptr, Metrics* metrics = nullptr)
+      : hasher_(hasher), cache_(cache), batcher_(pool, RegistrationBatcher::Options{}, metrics), loader_(pool, metrics) {}
+
+  // Hashes the password, then group-commits with concurrent registrations
+  // (see RegistrationBatcher).
+  folly::SemiFuture<RegisterResult> registerUser(std::string username, std::string password, std::string email) {
+    return hasher_.hash(std::move(password))
+      .deferValue([this, username = std::move(username), email = std::move(email)](std::string hash) mutable {
+        return batcher_.add({std::move(username), std::move(hash), std::move(email)});
+      })
+      .deferValue([this](RegisterResult r) {
+        // Drops a cached not_found for the new id.
+        if (cache_ && r.status == RegisterResult::Status::Created) cache_->invalidate(r.id);
+        return r;
+      });
+  }
+
+  // Serialized getUserById result; found = false for not_found.
+  struct UserJson {
+    std::unique_ptr<folly::IOBuf> body;
+    bool found;
+  };
+
+  // Cache-only lookup, for callers that can answer without deferring.
+  std::optional<UserJson> cachedUserJson(int id) {
+    if (!cache_) return std::nullopt;
+    auto hit = cache_->get(id);
+    if (!hit) return std::nullopt;
+    return UserJson{std::move(hit->json), hit->found};
+  }
+
+  // getUserById, serialized; fills the cache on the way out.
+  folly::SemiFuture<UserJson> getUserJson(int id) {
+    if (auto hit = cachedUserJson(id)) return folly::makeSemiFuture(std::move(*hit));
+    const uint64_t gen = cache_ ? cache_->generation(id) : 0;
+    return getUserById(id).deferValue([this, id, gen](nlohmann::json user) {
+      const bool found = !user.contains("error");
+      auto s = user.dump();
+      if (cache_) cache_->put(id, s, found, gen);
+      return UserJson{folly::IOBuf::copyBuffer(s), found};
+    });
+  }
+
+  // Batched per event-loop iteration with other lookups (see UserLoader).
+  folly::SemiFuture<nlohmann::json> getUserById(int id) { return loader_.load(id); }
+
+  // Checks `password` against a stored hash off the IO threads.
+  folly::SemiFuture<bool> verifyPassword(std::string storedHash, std::string password) {
+    return hasher_.verify(std::move(storedHash), std::move(password));
   }
 
-  nlohmann::json getUserById(int id) {
-    auto conn = pool_.acquire();
-    pqxx::work txn(*conn);
-    auto r = txn.exec("SELECT id, username, email FROM users WHERE id=$1",
-                        pqxx::params(id));
-    txn.commit();
-    pool_.release(conn);
-
-    if (r.empty()) {
-      return nlohmann::json::object({{"error", "not_found"}});
-    }
-
-    const pqxx::row row = r[0];
-    return nlohmann::json{{"id", row["id"].as<int>()},
-                          {"username", row["username"].as<std::string>()},
-                          {"email", row["email"].as<std::string>()}};
+  // One lookup per id, all sharing the loader batch; results in `ids` order.
+  folly::SemiFuture<std::vector<nlohmann::json>> getUsersByIds(const std::vector<int>& ids) {
+    std::vector<folly::SemiFuture<nlohmann::json>> fs;
+    fs.reserve(ids.size());
+    for (int id : ids) fs.push_back(loader_.load(id));
+    return folly::collect(std::move(fs));
   }
 
  private:
-  DBPool& pool_;
+  PasswordHasher& hasher_;
+  UserCache* cache_;
+  RegistrationBatcher batcher_;
+  UserLoader loader_;
 };
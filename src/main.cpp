@@ -1,73 +1,216 @@
 #include <folly/init/Init.h>
 #include <proxygen/httpserver/HTTPServer.h>
 
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
+#include "auth/PasswordHasher.h"
 #include "db/DB.h"
+#include "db/UserCache.h"
 #include "db/UserService.h"
 #include "dotenv.hpp"
 #include "router/Router.h"
+#include "server/H3Listener.h"
+#include "server/ServerConfig.h"
+#include "server/Tls.h"
+
+struct RegisterRequest {
+  std::string username, password, email;
+};
+template <> struct JsonSchema<RegisterRequest> {
+  static constexpr auto fields = std::make_tuple(
+      jsonRequired("username", &RegisterRequest::username),
+      jsonRequired("password", &RegisterRequest::password),
+      jsonRequired("email", &RegisterRequest::email));
+};
 
 int main(int argc, char *argv[]) {
   folly::Init init(&argc, &argv);
   dotenv::load(".env", /*overwrite=*/false, /*expand ${VAR}*/ true);
   const char *url = std::getenv("DATABASE_URL");
 
-  DBPool db(url, 8);
-  UserService userService(db);
+  static Metrics M; // global/simple
+  DBPool db(url, 8, &M);
+  UserCache userCache(UserCache::Options{}, &M);
+  PasswordHasher hasher(PasswordHasher::Options{}, &M);
+  UserService userService(db, hasher, &userCache, &M);
 
-  auto router = std::make_unique<RouterFactory>();
+  // Access log: ACCESS_LOG=<path>, ACCESS_LOG_FORMAT=json (default) or binary.
+  std::unique_ptr<AccessLog> accessLog;
+  if (const char *path = std::getenv("ACCESS_LOG")) {
+    AccessLogOptions lo;
+    lo.path = path;
+    const char *fmt = std::getenv("ACCESS_LOG_FORMAT");
+    if (fmt && std::string_view(fmt) == "binary") lo.format = AccessLogOptions::Format::Binary;
+    accessLog = std::make_unique<AccessLog>(lo, &M);
+  }
 
-  // --- middlewares: CORS, compression, request-id+metrics
+  auto router = std::make_unique<RouterFactory>();
 
-  // Enable built-in middlewares
-  router->useCORS();
+  // --- middlewares: request-id+metrics+access log and compression
+  // everywhere, CORS only on the API group (registered below)
+  router->useRequestIdLoggingAndMetrics(&M, accessLog.get());
   router->useCompression();
 
-  static Metrics metrics;
-  router->useRequestIdLoggingAndMetrics(&metrics);
-
-  static Metrics M; // global/simple
-  router->useRequestIdLoggingAndMetrics(&M);
+  // --- load shedding: Postgres-backed routes share the "db" concurrency
+  // limit; per-IP rate limiting only if RATE_LIMIT_PER_IP is set
+  AdmissionOptions admission;
+  admission.enabled = true;
+  if (const char *rate = std::getenv("RATE_LIMIT_PER_IP")) {
+    admission.ipRate = std::atof(rate);
+    admission.ipBurst = std::max(admission.ipRate, 1.0) * 2;
+  }
+  router->admission(admission);
 
   // --- routes
-  router->get("/ping", [](Res &res) { res.text("pong\n"); });
+  router->get("/ping", [](Res &res) {
+    res.staticBody("pong\n").header("content-type", "text/plain");
+  }).cacheable().admissionClass("");
 
   // Prometheus /metrics
   router->get("/metrics", [](Res &res) {
-    res.header("content-type", "text/plain; version=0.0.4").text(M.render());
-  });
+    res.text(M.render()).header("content-type", "text/plain; version=0.0.4");
+  }).admissionClass("");
 
   auto api = router->group("/api/v1");
+  api.useCORS();
   api.get("/users/:id", [&](Res &res) {
-    int id = std::stoi(res.ctx().param("id"));
-    auto user = userService.getUserById(id);
-    res.json(user);
-  });
-  api.post("/register", [&](const std::string &body, Res &res) {
-    auto j = nlohmann::json::parse(body);
-    auto result =
-        userService.registerUser(j["username"], j["password"], j["email"]);
-    if (result != "success") {
-      res.json("failed");
+    auto raw = res.ctx().param("id");
+    int id = 0;
+    if (std::from_chars(raw.data(), raw.data() + raw.size(), id).ec != std::errc()) {
+      res.json({{"error", "bad_id"}}, 400);
+      return;
+    }
+    // Hot ids are answered from the cache without leaving the EventBase.
+    if (auto hit = userService.cachedUserJson(id)) {
+      res.header("content-type", "application/json").body(std::move(hit->body));
+      return;
+    }
+    res.defer(userService.getUserJson(id).deferValue([&res](UserService::UserJson u) {
+      res.header("content-type", "application/json").body(std::move(u.body));
+    }));
+  }).coalesce().admissionClass("db");
+  // GET /users?ids=1,2,3 -> {"users":[...],"not_found":[...]}; shares the
+  // per-loop batching with /users/:id.
+  api.get("/users", [&](Res &res) {
+    constexpr size_t kMaxIds = 100;
+    std::string_view raw = res.ctx().query("ids");
+    std::vector<int> ids;
+    while (!raw.empty()) {
+      auto comma = raw.find(',');
+      auto item = raw.substr(0, comma);
+      raw = comma == std::string_view::npos ? std::string_view() : raw.substr(comma + 1);
+      int id = 0;
+      if (std::from_chars(item.data(), item.data() + item.size(), id).ec != std::errc() ||
+          ids.size() == kMaxIds) {
+        res.json({{"error", "bad_ids"}}, 400);
+        return;
+      }
+      ids.push_back(id);
+    }
+    if (ids.empty()) {
+      res.json({{"error", "bad_ids"}}, 400);
+      return;
     }
-    res.json("success");
-  });
-  api.get("/hello", [](Res &res) { res.json({{"msg", "hello"}}, 200, true); });
-  api.post("/echo", [](const std::string &body, Res &res) {
-    res.json({{"you_posted", body}});
-  });
-
-  // --- server
-  proxygen::HTTPServer::IPConfig ip{folly::SocketAddress("0.0.0.0", 8080, true),
-                                    proxygen::HTTPServer::Protocol::HTTP};
+    res.defer(userService.getUsersByIds(ids).deferValue(
+        [&res, ids](std::vector<nlohmann::json> users) {
+          auto found = nlohmann::json::array(), missing = nlohmann::json::array();
+          for (size_t i = 0; i < ids.size(); i++) {
+            if (users[i].contains("error")) missing.push_back(ids[i]);
+            else found.push_back(std::move(users[i]));
+          }
+          res.json({{"users", std::move(found)}, {"not_found", std::move(missing)}});
+        }));
+  }).admissionClass("db");
+  api.postJson<RegisterRequest>("/register", [&](RegisterRequest &req, Res &res) {
+    res.defer(userService.registerUser(std::move(req.username),
+                                       std::move(req.password),
+                                       std::move(req.email))
+        .deferValue([&res](UserService::RegisterResult r) {
+          using Status = UserService::RegisterResult::Status;
+          if (r.status == Status::Created) res.json("success");
+          else if (r.status == Status::Duplicate) res.json("duplicate", 409);
+          else res.json("failed");
+        }));
+  }).maxBody(64 * 1024).admissionClass("db");
+  api.get("/hello", [](Res &res) { res.json({{"msg", "hello"}}, 200, true); })
+      .cacheable();
+  api.post("/echo", [](folly::IOBuf &body, Res &res) {
+    res.json({{"you_posted", body.to<std::string>()}});
+  }).maxBody(1 << 20);
+
+  // Streams the body through without buffering it; replies with its size.
+  struct CountingReader : BodyReader {
+    size_t bytes = 0;
+    void onChunk(std::unique_ptr<folly::IOBuf> chunk) override {
+      bytes += chunk->computeChainDataLength();
+    }
+    void onEnd(Res &res) override { res.json({{"bytes", bytes}}); }
+  };
+  api.postStream("/upload", [](const RouteContext &) {
+    return std::make_unique<CountingReader>();
+  }).maxBody(size_t(1) << 30);
+
+  // Reverse proxy, e.g. PROXY_UPSTREAMS=10.0.0.1:8080,10.0.0.2:8080
+  if (const char *ups = std::getenv("PROXY_UPSTREAMS")) {
+    std::vector<std::string> upstreams;
+    for (std::string_view rest = ups; !rest.empty();) {
+      auto comma = rest.find(',');
+      if (comma != 0) upstreams.emplace_back(rest.substr(0, comma));
+      rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+    }
+    router->proxy("/svc/*rest", upstreams);
+  }
+
+  // Assets next to the API; ship .br/.gz siblings to avoid compressing
+  // on the fly.
+  if (const char *dir = std::getenv("STATIC_DIR")) {
+    StaticOptions so;
+    so.maxAgeSeconds = 3600;
+    router->staticDir("/assets", dir, so);
+  }
+
+  // --- server: h1/h2c, h2 over TLS and h3, per ServerConfig (env)
+  const ServerConfig cfg = ServerConfig::fromEnv();
+  std::unique_ptr<H3Listener> h3;
+  if (cfg.h3Port) {
+    h3 = std::make_unique<H3Listener>(cfg, router.get());
+    router->useAfter([alt = h3->altSvc()](const RouteContext &, Res &res) {
+      res.header(proxygen::HTTP_HEADER_ALT_SVC, alt);
+    });
+  }
+  // The QUIC listener does not call onServerStart; publish the routes up front.
+  router->freeze();
+
+  std::unique_ptr<TicketKeys> tickets;
+  if (cfg.tlsPort) {
+    if (cfg.ktls && !enableKernelTls()) std::cout << "kTLS unavailable, TLS stays in userspace\n";
+    tickets = std::make_unique<TicketKeys>(cfg, &M);
+  }
+
   proxygen::HTTPServerOptions opt;
-  opt.threads = std::thread::hardware_concurrency();
-  opt.handlerFactories =
-      proxygen::RequestHandlerChain().addThen(std::move(router)).build();
+  cfg.apply(opt);
+  opt.handlerFactories = proxygen::RequestHandlerChain()
+                             .addThen<TlsStatsFactory>(&M)
+                             .addThen(std::move(router))
+                             .build();
 
   proxygen::HTTPServer srv(std::move(opt));
-  srv.bind({ip});
-  std::cout << "🚀 Server running on http://127.0.0.1:8080\n";
+  srv.bind(cfg.tcpListeners(tickets ? tickets->initial() : wangle::TLSTicketKeySeeds{}));
+  if (tickets) tickets->start(srv);
+  if (cfg.httpPort) std::cout << "🚀 Server running on http://" << cfg.host << ":" << cfg.httpPort << "\n";
+  if (cfg.tlsPort) std::cout << "🔒 h2/TLS on port " << cfg.tlsPort << "\n";
+  if (h3) {
+    h3->start();
+    std::cout << "⚡ HTTP/3 on udp port " << cfg.h3Port << "\n";
+  }
   srv.start(); // blocking
+  if (tickets) tickets->stop();
+  if (h3) h3->stop();
 }
@@ -0,0 +1,248 @@
+#pragma once
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "Metrics.h"
+#include "RouteTable.h"
+
+// ----------------------------
+// Record
+// ----------------------------
+// One request, fixed size and trivially copyable. In the binary format the
+// file is just these structs back to back, in host byte order.
+struct AccessRecord {
+  int64_t timeUs = 0;      // wall clock at completion, microseconds since epoch
+  uint64_t bytes = 0;      // response body bytes
+  uint32_t latencyUs = 0;
+  int32_t routeId = -1;    // -1: matched no route
+  uint16_t status = 0;
+  uint16_t peerPort = 0;
+  uint8_t method = uint8_t(Method::Unknown);
+  uint8_t peerFamily = 0;  // AF_INET / AF_INET6, 0 if unknown
+  uint8_t peerAddr[16] = {};
+  char requestId[32] = {};
+
+  void setRequestId(std::string_view id) {
+    std::memcpy(requestId, id.data(), std::min(id.size(), sizeof(requestId)));
+  }
+};
+static_assert(std::is_trivially_copyable_v<AccessRecord>);
+
+struct AccessLogOptions {
+  enum class Format : uint8_t { JsonLines, Binary };
+
+  std::string path;                // appended to; created if missing
+  Format format = Format::JsonLines;
+  size_t ringRecords = 8192;       // per recording thread, rounded up to a power of two
+  std::chrono::milliseconds flushInterval{50};
+};
+
+// ----------------------------
+// AccessLog
+// ----------------------------
+// Every thread that logs gets its own single-producer/single-consumer ring
+// of AccessRecords; log() copies the record into the next slot and publishes
+// it with one release store. It takes no lock, makes no syscall and never
+// waits: when the ring is full the record is dropped and counted. A writer
+// thread wakes every flushInterval (more often while rings fill up), drains
+// all rings in batches, formats them and appends each batch with one
+// write(). Rings stay owned by the log after their thread exits, so nothing
+// logged is lost; a batch the file refuses counts as dropped.
+//
+// Exported on `metrics`: access_log_records_total, access_log_dropped_total.
+class AccessLog {
+ public:
+  explicit AccessLog(AccessLogOptions opts, Metrics* metrics = nullptr)
+      : opts_(std::move(opts)), instance_(nextInstance().fetch_add(1, std::memory_order_relaxed)) {
+    size_t cap = 1;
+    while (cap < std::max<size_t>(opts_.ringRecords, 2)) cap <<= 1;
+    opts_.ringRecords = cap;
+    fd_ = ::open(opts_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) throw std::runtime_error("access log: cannot open " + opts_.path);
+    if (metrics) {
+      written_ = &metrics->counter("access_log_records_total");
+      droppedTotal_ = &metrics->counter("access_log_dropped_total");
+    }
+    writer_ = std::thread([this] { run(); });
+  }
+  AccessLog(const AccessLog&) = delete;
+  AccessLog& operator=(const AccessLog&) = delete;
+
+  // Drains whatever is left, then closes the file.
+  ~AccessLog() {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+    ::close(fd_);
+  }
+
+  // Hot path. False if the record was dropped.
+  bool log(const AccessRecord& r) {
+    Ring& ring = this->ring();
+    const uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    if (tail - ring.headCache >= ring.mask + 1) {
+      ring.headCache = ring.head.load(std::memory_order_acquire);
+      if (tail - ring.headCache >= ring.mask + 1) {
+        bump(ring.dropped);
+        return false;
+      }
+    }
+    ring.slots[tail & ring.mask] = r;
+    ring.tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  uint64_t dropped() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    uint64_t n = writeDropped_.load(std::memory_order_relaxed);
+    for (auto& r : rings_) n += r->dropped.load(std::memory_order_relaxed);
+    return n;
+  }
+
+  // Appends `r` to `out` as one JSON line.
+  static void formatJson(const AccessRecord& r, std::string& out) {
+    char peer[INET6_ADDRSTRLEN] = "";
+    if (r.peerFamily == AF_INET || r.peerFamily == AF_INET6) inet_ntop(r.peerFamily, r.peerAddr, peer, sizeof(peer));
+    char line[320];
+    const int n = snprintf(line, sizeof(line),
+      "{\"ts\":%lld.%06lld,\"id\":\"%.32s\",\"method\":\"%s\",\"route\":%d,\"status\":%u,"
+      "\"bytes\":%llu,\"latency_us\":%u,\"peer\":\"%s%s%s:%u\"}\n",
+      (long long)(r.timeUs / 1000000), (long long)(r.timeUs % 1000000), r.requestId,
+      methodName(Method(r.method)), r.routeId, unsigned(r.status), (unsigned long long)r.bytes,
+      r.latencyUs, r.peerFamily == AF_INET6 ? "[" : "", peer, r.peerFamily == AF_INET6 ? "]" : "",
+      unsigned(r.peerPort));
+    if (n > 0) out.append(line, std::min(size_t(n), sizeof(line) - 1));
+  }
+
+ private:
+  struct Ring {
+    explicit Ring(size_t cap) : slots(new AccessRecord[cap]), mask(cap - 1) {}
+    std::unique_ptr<AccessRecord[]> slots;
+    const uint64_t mask;
+    alignas(64) std::atomic<uint64_t> head{0};     // consumer
+    alignas(64) std::atomic<uint64_t> tail{0};     // producer
+    uint64_t headCache = 0;                        // producer's last view of head
+    std::atomic<uint64_t> dropped{0};              // producer
+  };
+
+  static constexpr size_t kBatchBytes = 256 << 10;
+
+  static std::atomic<uint64_t>& nextInstance() { static std::atomic<uint64_t> n{0}; return n; }
+
+  // Same scheme as Metrics::shard(): slots keyed by instance id, ring
+  // registered under the lock on a thread's first record.
+  Ring& ring() {
+    struct Slot { uint64_t instance; Ring* ring; };
+    static thread_local std::vector<Slot> slots;
+    static thread_local Slot last{UINT64_MAX, nullptr};
+    if (last.instance == instance_) return *last.ring;
+    for (auto& sl : slots) if (sl.instance == instance_) { last = sl; return *sl.ring; }
+
+    std::lock_guard<std::mutex> lk(mu_);
+    rings_.push_back(std::make_unique<Ring>(opts_.ringRecords));
+    last = {instance_, rings_.back().get()};
+    slots.push_back(last);
+    return *last.ring;
+  }
+
+  void run() {
+    std::vector<Ring*> rings;
+    std::string buf;
+    buf.reserve(kBatchBytes + 512);
+    // A ring found more than a quarter full means traffic outpaces the
+    // interval; poll every millisecond until it calms down.
+    auto wait = opts_.flushInterval;
+    for (bool stopping = false; !stopping;) {
+      {
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait_for(lk, wait, [this] { return stopping_; });
+        stopping = stopping_;
+        rings.clear();
+        for (auto& r : rings_) rings.push_back(r.get());
+      }
+      uint64_t drops = 0, busiest = 0;
+      for (Ring* r : rings) {
+        busiest = std::max(busiest, drain(*r, buf));
+        drops += r->dropped.load(std::memory_order_relaxed);
+      }
+      wait = busiest > opts_.ringRecords / 4
+        ? std::min(opts_.flushInterval, std::chrono::milliseconds(1)) : opts_.flushInterval;
+      flush(buf);
+      if (droppedTotal_)
+        droppedTotal_->store(drops + writeDropped_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+  }
+
+  // Returns how many records the ring held.
+  uint64_t drain(Ring& r, std::string& buf) {
+    uint64_t head = r.head.load(std::memory_order_relaxed);
+    const uint64_t tail = r.tail.load(std::memory_order_acquire), held = tail - head;
+    for (; head != tail; head++) {
+      const AccessRecord& rec = r.slots[head & r.mask];
+      if (opts_.format == AccessLogOptions::Format::Binary)
+        buf.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+      else
+        formatJson(rec, buf);
+      pending_++;
+      if (buf.size() >= kBatchBytes) {
+        r.head.store(head + 1, std::memory_order_release);
+        flush(buf);
+      }
+    }
+    r.head.store(tail, std::memory_order_release);
+    return held;
+  }
+
+  // On a write error the rest of the batch is dropped rather than stalling
+  // the writer, and its records count as dropped, not written.
+  void flush(std::string& buf) {
+    size_t off = 0;
+    while (off < buf.size()) {
+      const ssize_t n = ::write(fd_, buf.data() + off, buf.size() - off);
+      if (n > 0) off += size_t(n);
+      else if (n < 0 && errno == EINTR) continue;
+      else break;
+    }
+    if (off == buf.size()) {
+      if (written_ && pending_) written_->fetch_add(pending_, std::memory_order_relaxed);
+    } else {
+      writeDropped_.fetch_add(pending_, std::memory_order_relaxed);
+    }
+    pending_ = 0;
+    buf.clear();
+  }
+
+  AccessLogOptions opts_;
+  const uint64_t instance_;
+  int fd_ = -1;
+  mutable std::mutex mu_;  // guards rings_ registration and stopping_
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::vector<std::unique_ptr<Ring>> rings_;
+  uint64_t pending_ = 0;  // writer thread: records in the unflushed batch
+  std::atomic<uint64_t> writeDropped_{0};  // records lost to failed writes
+  std::atomic<uint64_t>* written_ = nullptr;
+  std::atomic<uint64_t>* droppedTotal_ = nullptr;
+  std::thread writer_;
+};
@@ -0,0 +1,174 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Metrics.h"
+
+struct AdmissionOptions {
+  bool enabled = false;
+  // Concurrency limit per route class, adapted from observed latency.
+  int64_t initialLimit = 64;
+  int64_t minLimit = 8;
+  int64_t maxLimit = 4096;
+  double smoothing = 0.2;  // how fast the limit follows its target
+  // Per client IP token bucket; ipRate = 0 turns it off.
+  double ipRate = 0;       // tokens per second
+  double ipBurst = 100;
+  size_t ipBuckets = 1 << 16;
+  uint32_t retryAfterSeconds = 1;
+};
+
+// ----------------------------
+// Concurrency limit
+// ----------------------------
+// Gradient-style adaptive limit. Requests over the limit are shed. Every
+// completion feeds its latency into a short and a long moving average;
+// while the short one stays near the long one (no queueing) the limit
+// creeps up by sqrt(limit), and as latency rises above the long-term
+// baseline it is pulled down toward as little as half (each update moves
+// it `smoothing` of the way).
+//
+// acquire/release are one atomic op each; the limit update takes a mutex
+// with try_lock and is simply skipped when another thread holds it.
+class ConcurrencyLimiter {
+ public:
+  ConcurrencyLimiter(const std::string& name, const AdmissionOptions& o, Metrics* metrics)
+      : opts_(o), limitD_(double(o.initialLimit)) {
+    if (metrics) {
+      inflight_ = &metrics->gauge("admission_" + name + "_inflight");
+      limit_ = &metrics->gauge("admission_" + name + "_limit");
+      shed_ = &metrics->counter("admission_" + name + "_shed_total");
+    } else {
+      own_ = std::make_unique<Own>();
+      inflight_ = &own_->inflight;
+      limit_ = &own_->limit;
+    }
+    limit_->store(o.initialLimit, std::memory_order_relaxed);
+  }
+  ConcurrencyLimiter(const ConcurrencyLimiter&) = delete;
+  ConcurrencyLimiter& operator=(const ConcurrencyLimiter&) = delete;
+
+  bool acquire() {
+    const int64_t prev = inflight_->fetch_add(1, std::memory_order_relaxed);
+    if (prev < limit_->load(std::memory_order_relaxed)) return true;
+    inflight_->fetch_sub(1, std::memory_order_relaxed);
+    if (shed_) shed_->fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  // `sample` = false for requests that did not complete normally (their
+  // latency says nothing about the backend).
+  void release(std::chrono::steady_clock::duration rtt, bool sample) {
+    const int64_t inflight = inflight_->fetch_sub(1, std::memory_order_relaxed);
+    if (sample) update(std::chrono::duration<double, std::micro>(rtt).count(), inflight);
+  }
+
+ private:
+  void update(double rttUs, int64_t inflight) {
+    std::unique_lock<std::mutex> lk(mu_, std::try_to_lock);
+    if (!lk.owns_lock()) return;
+    if (shortRtt_ == 0) shortRtt_ = longRtt_ = rttUs;
+    shortRtt_ += (rttUs - shortRtt_) * 0.1;
+    longRtt_ += (rttUs - longRtt_) * 0.005;
+    // Let the baseline recover after a long stretch of high latency.
+    if (longRtt_ > 2 * shortRtt_) longRtt_ *= 0.95;
+    const double gradient = std::clamp(longRtt_ / shortRtt_, 0.5, 1.0);
+    const double target = limitD_ * gradient + std::sqrt(limitD_);
+    const double next = std::clamp(limitD_ * (1 - opts_.smoothing) + target * opts_.smoothing,
+                                   double(opts_.minLimit), double(opts_.maxLimit));
+    // Don't grow while the limit is not what is holding traffic back.
+    if (next > limitD_ && inflight < limitD_ / 2) return;
+    limitD_ = next;
+    limit_->store(int64_t(limitD_), std::memory_order_relaxed);
+  }
+
+  struct Own { std::atomic<int64_t> inflight{0}, limit{0}; };
+
+  const AdmissionOptions opts_;
+  std::unique_ptr<Own> own_;  // when there is no Metrics to hold the gauges
+  std::atomic<int64_t>* inflight_ = nullptr;
+  std::atomic<int64_t>* limit_ = nullptr;
+  std::atomic<uint64_t>* shed_ = nullptr;
+
+  std::mutex mu_;  // guards the fields below
+  double limitD_;
+  double shortRtt_ = 0, longRtt_ = 0;
+};
+
+// ----------------------------
+// Per-client rate limit
+// ----------------------------
+// Token buckets in a fixed table indexed by a hash of the client IP (IPs
+// that collide share a bucket). Each bucket is one 64-bit word, tokens in
+// thousandths in the high half and the last refill time in ms in the low
+// half, updated with a CAS loop: no locks and no allocation per client.
+class IpRateLimiter {
+ public:
+  IpRateLimiter(const AdmissionOptions& o, Metrics* metrics)
+      : perMs_(o.ipRate),  // thousandths per ms == tokens per second
+        burst_(uint64_t(o.ipBurst * 1000)),
+        fillMs_(uint32_t(std::min(std::ceil(double(burst_) / std::max(perMs_, 1e-6)), double(1u << 31)))),
+        buckets_(std::max<size_t>(o.ipBuckets, 1)),
+        epoch_(std::chrono::steady_clock::now()) {
+    if (metrics) limited_ = &metrics->counter("admission_ip_limited_total");
+  }
+
+  bool allow(std::string_view ip) { return allow(ip, nowMs()); }
+
+  // As allow(ip) at time `now`, in ms on a clock that wraps at 2^32.
+  bool allow(std::string_view ip, uint32_t now) {
+    now |= 1;  // never 0, so a used bucket is never mistaken for a fresh one
+    auto& b = buckets_[std::hash<std::string_view>{}(ip) % buckets_.size()];
+    uint64_t old = b.load(std::memory_order_relaxed);
+    for (;;) {
+      uint64_t tokens = old >> 32;
+      uint32_t last = uint32_t(old);
+      // The clock wraps every ~49 days, so the time since the last refill
+      // is only trusted up to how long an empty bucket takes to fill. Just
+      // behind `last` means another thread stored a later time than our
+      // `now`: that refills nothing, and the stored time never moves
+      // backwards. Anything else is a bucket left alone for long enough
+      // to be full again.
+      const uint32_t elapsed = now - last;
+      const bool behind = elapsed > UINT32_MAX - kSkewMs;
+      if (old == 0 || (elapsed > fillMs_ && !behind)) {
+        tokens = burst_;  // a fresh bucket starts full too
+        last = now;
+      } else if (!behind) {
+        tokens = std::min<uint64_t>(burst_, tokens + uint64_t(elapsed * perMs_));
+        last = now;
+      }
+      if (tokens < 1000) {
+        if (limited_) limited_->fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      const uint64_t next = ((tokens - 1000) << 32) | last;
+      if (b.compare_exchange_weak(old, next, std::memory_order_relaxed)) return true;
+    }
+  }
+
+ private:
+  // How far a racing thread's `now` may trail the time stored in a bucket.
+  static constexpr uint32_t kSkewMs = 60 * 1000;
+
+  uint32_t nowMs() const {
+    return uint32_t(std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - epoch_).count());
+  }
+
+  const double perMs_;
+  const uint64_t burst_;
+  const uint32_t fillMs_;  // time for an empty bucket to fill up
+  std::vector<std::atomic<uint64_t>> buckets_;
+  const std::chrono::steady_clock::time_point epoch_;
+  std::atomic<uint64_t>* limited_ = nullptr;
+};
@@ -0,0 +1,28 @@
+#pragma once
+#include <folly/io/IOBuf.h>
+#include <proxygen/httpserver/ResponseHandler.h>
+#include <memory>
+#include "Response.h"
+
+// Streaming request body consumer. Created once the request headers are in;
+// chunks are delivered as proxygen reads them, without buffering the body.
+// A reader that cannot keep up calls pauseIngress() and later
+// resumeIngress() (on the request's EventBase) to apply flow control.
+class BodyReader {
+ public:
+  virtual ~BodyReader() = default;
+
+  virtual void onChunk(std::unique_ptr<folly::IOBuf> chunk) = 0;
+  // Body complete; fill in the response.
+  virtual void onEnd(Res& res) = 0;
+  // Request rejected or torn down before onEnd (size limit, client error).
+  virtual void onAbort() {}
+
+ protected:
+  void pauseIngress() { if (downstream_) downstream_->pauseIngress(); }
+  void resumeIngress() { if (downstream_) downstream_->resumeIngress(); }
+
+ private:
+  friend class RouterHandler;
+  proxygen::ResponseHandler* downstream_ = nullptr;
+};
@@ -0,0 +1,226 @@
+#include "Compression.h"
+
+#include <folly/io/IOBufQueue.h>
+#include <brotli/encode.h>
+#include <zlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+// ============================================================================
+// Content negotiation
+// ============================================================================
+
+const char* encodingName(Encoding e) {
+  switch (e) {
+    case Encoding::Gzip:   return "gzip";
+    case Encoding::Brotli: return "br";
+    default:               return "identity";
+  }
+}
+
+namespace {
+
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && (s.front()==' ' || s.front()=='\t')) s.remove_prefix(1);
+  while (!s.empty() && (s.back()==' ' || s.back()=='\t')) s.remove_suffix(1);
+  return s;
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i=0; i<a.size(); i++)
+    if (::tolower((unsigned char)a[i]) != ::tolower((unsigned char)b[i])) return false;
+  return true;
+}
+
+// q-value in thousandths; malformed values count as 0.
+int parseQ(std::string_view v) {
+  v = trim(v);
+  if (v.empty() || (v[0]!='0' && v[0]!='1')) return 0;
+  int q = (v[0]-'0') * 1000;
+  if (v.size() > 1 && v[1]=='.') {
+    int scale = 100;
+    for (size_t i=2; i<v.size() && i<5 && scale>0; i++, scale/=10) {
+      if (v[i]<'0' || v[i]>'9') return 0;
+      q += (v[i]-'0') * scale;
+    }
+  }
+  return std::min(q, 1000);
+}
+
+// q-values of the codings we support, -1 where not mentioned at all.
+struct Accepted { int br = -1, gzip = -1; };
+
+Accepted parseAcceptEncoding(std::string_view ae) {
+  int br=-1, gzip=-1, star=-1;
+  while (!ae.empty()) {
+    size_t comma = ae.find(',');
+    std::string_view item = ae.substr(0, comma);
+    ae = comma==std::string_view::npos ? std::string_view() : ae.substr(comma+1);
+
+    int q = 1000;
+    size_t semi = item.find(';');
+    std::string_view coding = trim(item.substr(0, semi));
+    std::string_view params = semi==std::string_view::npos ? std::string_view() : item.substr(semi+1);
+    while (!params.empty()) {
+      size_t next = params.find(';');
+      std::string_view param = trim(params.substr(0, next));
+      if (param.size() >= 2 && (param[0]=='q' || param[0]=='Q') && param[1]=='=') q = parseQ(param.substr(2));
+      params = next==std::string_view::npos ? std::string_view() : params.substr(next+1);
+    }
+
+    if (iequals(coding, "br")) br = q;
+    else if (iequals(coding, "gzip") || iequals(coding, "x-gzip")) gzip = q;
+    else if (coding == "*") star = q;
+  }
+  if (br < 0) br = star;
+  if (gzip < 0) gzip = star;
+  return {br, gzip};
+}
+
+} // namespace
+
+Encoding negotiateEncoding(std::string_view ae) {
+  const Accepted a = parseAcceptEncoding(ae);
+  if (a.br <= 0 && a.gzip <= 0) return Encoding::Identity;
+  return a.br >= a.gzip ? Encoding::Brotli : Encoding::Gzip;
+}
+
+bool acceptsEncoding(std::string_view ae, Encoding e) {
+  const Accepted a = parseAcceptEncoding(ae);
+  switch (e) {
+    case Encoding::Brotli: return a.br > 0;
+    case Encoding::Gzip:   return a.gzip > 0;
+    default:               return true;
+  }
+}
+
+bool isCompressible(std::string_view ct, const CompressionOptions& o) {
+  for (auto& t : o.types) {
+    if (ct.size() >= t.size() && iequals(ct.substr(0, t.size()), t)) return true;
+  }
+  return false;
+}
+
+// ============================================================================
+// Adaptive level
+// ============================================================================
+
+int compressionLevel(Encoding e, const CompressionOptions& o) {
+  const int max = e==Encoding::Brotli ? o.brotliQuality : o.gzipLevel;
+  if (!o.adaptiveLevel) return max;
+
+  struct Sample { std::chrono::steady_clock::time_point at; double perCore = 0; };
+  static thread_local Sample s;
+  const auto now = std::chrono::steady_clock::now();
+  if (now - s.at >= std::chrono::seconds(1)) {
+    double load = 0;
+    static const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    if (getloadavg(&load, 1) == 1) s.perCore = load / cores;
+    s.at = now;
+  }
+  if (s.perCore < 0.5)  return max;
+  if (s.perCore < 0.75) return std::max(1, max*2/3);
+  if (s.perCore < 1.0)  return std::max(1, max/3);
+  return 1;
+}
+
+// ============================================================================
+// Encoder
+// ============================================================================
+
+namespace {
+
+size_t chunkFor(size_t inLen) {
+  return std::clamp<size_t>(inLen/2, 4096, 64*1024);
+}
+
+struct GzipState {
+  z_stream zs{};
+  int level = Z_DEFAULT_COMPRESSION;
+  bool ok = false;
+  GzipState() {
+    ok = deflateInit2(&zs, level, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+  }
+  ~GzipState() { if (ok) deflateEnd(&zs); }
+};
+
+std::unique_ptr<folly::IOBuf> gzipChain(const folly::IOBuf& in, int level) {
+  static thread_local GzipState st;
+  if (!st.ok) return nullptr;
+  z_stream& zs = st.zs;
+  if (deflateReset(&zs) != Z_OK) return nullptr;
+  if (level != st.level) {
+    if (deflateParams(&zs, level, Z_DEFAULT_STRATEGY) != Z_OK) return nullptr;
+    st.level = level;
+  }
+
+  const size_t chunk = chunkFor(in.computeChainDataLength());
+  folly::IOBufQueue out{folly::IOBufQueue::cacheChainLength()};
+  // Z_NO_FLUSH: drain until deflate leaves output space unused (input is
+  // consumed). Z_FINISH: until the stream ends.
+  auto pump = [&](int flush) {
+    int ret;
+    do {
+      auto room = out.preallocate(1024, chunk);
+      zs.next_out = static_cast<Bytef*>(room.first);
+      zs.avail_out = uInt(room.second);
+      ret = deflate(&zs, flush);
+      out.postallocate(room.second - zs.avail_out);
+      if (ret == Z_STREAM_ERROR) return ret;
+    } while (flush == Z_FINISH ? ret != Z_STREAM_END : zs.avail_out == 0);
+    return ret;
+  };
+  for (auto r : in) {
+    if (r.size() == 0) continue;
+    zs.next_in = const_cast<Bytef*>(r.data());
+    zs.avail_in = uInt(r.size());
+    if (pump(Z_NO_FLUSH) == Z_STREAM_ERROR) return nullptr;
+  }
+  zs.next_in = nullptr; zs.avail_in = 0;
+  if (pump(Z_FINISH) != Z_STREAM_END) return nullptr;
+  return out.move();
+}
+
+std::unique_ptr<folly::IOBuf> brotliChain(const folly::IOBuf& in, int quality) {
+  std::unique_ptr<BrotliEncoderState, void(*)(BrotliEncoderState*)> st(
+    BrotliEncoderCreateInstance(nullptr, nullptr, nullptr), BrotliEncoderDestroyInstance);
+  if (!st) return nullptr;
+  const size_t total = in.computeChainDataLength();
+  BrotliEncoderSetParameter(st.get(), BROTLI_PARAM_QUALITY, uint32_t(quality));
+  BrotliEncoderSetParameter(st.get(), BROTLI_PARAM_SIZE_HINT, uint32_t(std::min<size_t>(total, 1u<<30)));
+
+  const size_t chunk = chunkFor(total);
+  folly::IOBufQueue out{folly::IOBufQueue::cacheChainLength()};
+  auto pump = [&](BrotliEncoderOperation op, const uint8_t* data, size_t len) {
+    size_t availIn = len;
+    const uint8_t* nextIn = data;
+    do {
+      auto room = out.preallocate(1024, chunk);
+      size_t availOut = room.second;
+      uint8_t* nextOut = static_cast<uint8_t*>(room.first);
+      if (!BrotliEncoderCompressStream(st.get(), op, &availIn, &nextIn, &availOut, &nextOut, nullptr))
+        return false;
+      out.postallocate(room.second - availOut);
+    } while (availIn > 0 || BrotliEncoderHasMoreOutput(st.get()) ||
+             (op == BROTLI_OPERATION_FINISH && !BrotliEncoderIsFinished(st.get())));
+    return true;
+  };
+  for (auto r : in) {
+    if (r.size() && !pump(BROTLI_OPERATION_PROCESS, r.data(), r.size())) return nullptr;
+  }
+  if (!pump(BROTLI_OPERATION_FINISH, nullptr, 0)) return nullptr;
+  return out.move();
+}
+
+} // namespace
+
+std::unique_ptr<folly::IOBuf> compressBody(Encoding e, const folly::IOBuf& in, int level) {
+  switch (e) {
+    case Encoding::Gzip:   return gzipChain(in, level);
+    case Encoding::Brotli: return brotliChain(in, level);
+    default:               return nullptr;
+  }
+}
@@ -1,19 +1,53 @@
 #pragma once
+#include <folly/io/IOBuf.h>
+#include <memory>
 #include <string>
-#include <zlib.h>
-#include <brotli/encode.h>
-
-inline bool gzipCompress(const std::string& in,std::string& out){
-  z_stream zs{}; if(deflateInit2(&zs,Z_BEST_SPEED,Z_DEFLATED,15+16,8,Z_DEFAULT_STRATEGY)!=Z_OK) return false;
-  zs.next_in=(Bytef*)in.data(); zs.avail_in=uInt(in.size());
-  char buf[1<<14]; int ret; do{ zs.next_out=(Bytef*)buf; zs.avail_out=sizeof(buf);
-    ret=deflate(&zs,zs.avail_in?Z_NO_FLUSH:Z_FINISH);
-    out.append(buf,sizeof(buf)-zs.avail_out);
-  } while(ret==Z_OK); deflateEnd(&zs); return ret==Z_STREAM_END;
-}
-inline bool brotliCompress(const std::string& in,std::string& out){
-  size_t out_len=BrotliEncoderMaxCompressedSize(in.size()); out.resize(out_len);
-  auto ok=BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY,BROTLI_DEFAULT_WINDOW,BROTLI_MODE_GENERIC,
-    in.size(),(const uint8_t*)in.data(),&out_len,(uint8_t*)out.data());
-  if(!ok) return false; out.resize(out_len); return true;
-}
+#include <string_view>
+#include <vector>
+
+// ----------------------------
+// Content negotiation
+// ----------------------------
+enum class Encoding : uint8_t { Identity, Gzip, Brotli };
+
+const char* encodingName(Encoding e);
+
+// Picks the best coding we support from an Accept-Encoding value, honouring
+// q-values ("br;q=0", "*;q=0.5", ...). Ties prefer brotli.
+Encoding negotiateEncoding(std::string_view acceptEncoding);
+
+// Whether `e` is acceptable at all (q > 0) under an Accept-Encoding value.
+bool acceptsEncoding(std::string_view acceptEncoding, Encoding e);
+
+// ----------------------------
+// Options
+// ----------------------------
+struct CompressionOptions {
+  size_t minBytes = 512;  // smaller bodies go out as-is
+  // Media-type prefixes worth compressing; everything else (images,
+  // archives, already-encoded payloads) is skipped.
+  std::vector<std::string> types{
+    "text/", "application/json", "application/javascript",
+    "application/xml", "image/svg+xml"};
+  // Upper bounds; with adaptiveLevel they are lowered as CPU load rises.
+  int gzipLevel = 6;
+  int brotliQuality = 5;
+  bool adaptiveLevel = true;
+};
+
+bool isCompressible(std::string_view contentType, const CompressionOptions& o);
+
+// Level to use right now for `e`, scaled down from the configured maximum
+// by the 1-minute load average per core (sampled at most once a second per
+// thread).
+int compressionLevel(Encoding e, const CompressionOptions& o);
+
+// ----------------------------
+// Encoder
+// ----------------------------
+// Compresses the whole chain `in` and returns the output as an IOBuf chain
+// (nullptr on failure). Input buffers are consumed in place without
+// coalescing. The gzip z_stream is thread-local and reset between bodies;
+// brotli has no reset, so its state is per call, but it writes straight into
+// the output chain as well.
+std::unique_ptr<folly::IOBuf> compressBody(Encoding e, const folly::IOBuf& in, int level);
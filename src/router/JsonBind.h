@@ -0,0 +1,153 @@
+#pragma once
+#include <folly/io/IOBuf.h>
+#include <simdjson.h>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// ----------------------------
+// Declaring a binding
+// ----------------------------
+// Map JSON object keys to members by specializing JsonSchema:
+//
+//   struct Signup { std::string username, email; std::optional<int64_t> age; };
+//   template <> struct JsonSchema<Signup> {
+//     static constexpr auto fields = std::make_tuple(
+//       jsonRequired("username", &Signup::username),
+//       jsonRequired("email", &Signup::email),
+//       jsonOptional("age", &Signup::age));
+//   };
+//
+// Supported member types: std::string, bool, integers, double and
+// std::optional of those (JSON null leaves it empty). Unknown keys are
+// skipped; at most 64 fields.
+template <class T> struct JsonSchema;
+
+template <class T, class M>
+struct JsonField {
+  std::string_view name;
+  M T::* member;
+  bool required;
+};
+
+template <class T, class M>
+constexpr JsonField<T, M> jsonRequired(std::string_view name, M T::* m) { return {name, m, true}; }
+template <class T, class M>
+constexpr JsonField<T, M> jsonOptional(std::string_view name, M T::* m) { return {name, m, false}; }
+
+// ----------------------------
+// Binding
+// ----------------------------
+namespace jsonbind_detail {
+
+inline bool read(simdjson::ondemand::value v, std::string& out) {
+  std::string_view s;
+  if (v.get_string().get(s)) return false;
+  out.assign(s);
+  return true;
+}
+inline bool read(simdjson::ondemand::value v, bool& out) { return !v.get_bool().get(out); }
+inline bool read(simdjson::ondemand::value v, double& out) { return !v.get_double().get(out); }
+
+template <class I, std::enable_if_t<std::is_integral_v<I> && !std::is_same_v<I, bool>, int> = 0>
+bool read(simdjson::ondemand::value v, I& out) {
+  if constexpr (std::is_signed_v<I>) {
+    int64_t n;
+    if (v.get_int64().get(n) || n < std::numeric_limits<I>::min() || n > std::numeric_limits<I>::max()) return false;
+    out = I(n);
+  } else {
+    uint64_t n;
+    if (v.get_uint64().get(n) || n > std::numeric_limits<I>::max()) return false;
+    out = I(n);
+  }
+  return true;
+}
+
+template <class U>
+bool read(simdjson::ondemand::value v, std::optional<U>& out) {
+  bool null = false;
+  if (v.is_null().get(null)) return false;
+  if (null) { out.reset(); return true; }
+  return read(v, out.emplace());
+}
+
+// Assigns the value of `key` to its member. matched = false for keys the
+// schema does not mention.
+template <class T, class Tuple, size_t... I>
+bool assign(std::string_view key, simdjson::ondemand::value v, T& out, const Tuple& fields,
+            uint64_t& seen, bool& matched, std::index_sequence<I...>) {
+  bool ok = true;
+  ((!matched && std::get<I>(fields).name == key
+      ? (void)(matched = true, ok = read(v, out.*(std::get<I>(fields).member)), seen |= uint64_t(1) << I)
+      : (void)0), ...);
+  return ok;
+}
+
+template <class Tuple, size_t... I>
+std::string_view firstMissing(const Tuple& fields, uint64_t seen, std::index_sequence<I...>) {
+  std::string_view missing;
+  ((missing.empty() && std::get<I>(fields).required && !(seen & (uint64_t(1) << I))
+      ? (void)(missing = std::get<I>(fields).name) : (void)0), ...);
+  return missing;
+}
+
+// simdjson reads up to SIMDJSON_PADDING bytes past the end of the input. A
+// single buffer with that much tailroom is parsed in place; anything else
+// is copied once into a thread-local padded scratch buffer.
+inline simdjson::padded_string_view padded(const folly::IOBuf& body) {
+  if (!body.isChained() && body.tailroom() >= simdjson::SIMDJSON_PADDING)
+    return simdjson::padded_string_view(reinterpret_cast<const char*>(body.data()), body.length(),
+                                        body.length() + body.tailroom());
+  static thread_local std::string scratch;
+  const size_t len = body.computeChainDataLength();
+  scratch.resize(len + simdjson::SIMDJSON_PADDING);
+  size_t off = 0;
+  for (auto r : body) { std::memcpy(scratch.data() + off, r.data(), r.size()); off += r.size(); }
+  return simdjson::padded_string_view(scratch.data(), len, scratch.size());
+}
+
+} // namespace jsonbind_detail
+
+// Parses `body` (a JSON object) on demand and fills `out` per
+// JsonSchema<T>. On failure returns false with a short reason in `error`.
+template <class T>
+bool bindJson(const folly::IOBuf& body, T& out, std::string& error) {
+  using namespace jsonbind_detail;
+  constexpr auto& fields = JsonSchema<T>::fields;
+  constexpr size_t n = std::tuple_size_v<std::decay_t<decltype(fields)>>;
+  static_assert(n <= 64, "JsonSchema supports at most 64 fields");
+  constexpr auto idx = std::make_index_sequence<n>{};
+
+  static thread_local simdjson::ondemand::parser parser;
+  simdjson::ondemand::document doc;
+  simdjson::ondemand::object obj;
+  if (parser.iterate(padded(body)).get(doc) || doc.get_object().get(obj)) {
+    error = "body must be a JSON object";
+    return false;
+  }
+
+  uint64_t seen = 0;
+  for (auto f : obj) {
+    std::string_view key;
+    simdjson::ondemand::value v;
+    if (f.unescaped_key().get(key) || f.value().get(v)) { error = "malformed JSON"; return false; }
+    bool matched = false;
+    if (!assign(key, v, out, fields, seen, matched, idx)) {
+      error = "field '" + std::string(key) + "' has the wrong type";
+      return false;
+    }
+  }
+  if (!doc.at_end()) { error = "malformed JSON"; return false; }
+
+  if (auto missing = firstMissing(fields, seen, idx); !missing.empty()) {
+    error = "missing field '" + std::string(missing) + "'";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <folly/io/IOBuf.h>
+#include <nlohmann/json.hpp>
+#include <memory>
+#include <string>
+
+// j serialized as by j.dump(pretty ? 2 : -1), as an IOBuf. The IOBuf takes
+// over the dumped string's storage, so the body is written once and never
+// copied on its way to the wire. Only nlohmann's public API is used, so
+// library upgrades cannot break it.
+inline std::unique_ptr<folly::IOBuf> jsonToIOBuf(const nlohmann::json& j, bool pretty = false) {
+  std::string s = j.dump(pretty ? 2 : -1);
+  return folly::IOBuf::fromString(std::move(s));
+}
@@ -1,28 +1,254 @@
 #pragma once
-#include <unordered_map>
-#include <mutex>
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+
+// Single-writer counter: only the owning thread increments it, so a relaxed
+// load+store is enough and avoids a locked RMW; readers may see it lag.
+inline void bump(std::atomic<uint64_t>& c, uint64_t n = 1) {
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// ----------------------------
+// Latency histogram
+// ----------------------------
+// HDR-style log-linear buckets over microseconds: one bucket below 64us,
+// two sub-buckets per power of two up to ~33s, then +Inf.
+struct LatencyHistogram {
+  static constexpr int kMinShift = 6, kMaxShift = 25;
+  static constexpr size_t kBuckets = 2 + 2*(kMaxShift-kMinShift);
+
+  std::array<std::atomic<uint64_t>, kBuckets> buckets{};
+  std::atomic<uint64_t> sumUs{0};
+
+  static size_t bucketFor(uint64_t us) {
+    if (us < (uint64_t(1) << kMinShift)) return 0;
+    const int msb = 63 - __builtin_clzll(us);
+    if (msb >= kMaxShift) return kBuckets-1;
+    return 1 + 2*size_t(msb-kMinShift) + ((us >> (msb-1)) & 1);
+  }
+  // Exclusive upper bound of bucket b; UINT64_MAX for +Inf.
+  static uint64_t upperBoundUs(size_t b) {
+    if (b == 0) return uint64_t(1) << kMinShift;
+    if (b == kBuckets-1) return UINT64_MAX;
+    const int m = kMinShift + int(b-1)/2;
+    return (uint64_t(1) << m) + ((b-1)%2 + 1) * (uint64_t(1) << (m-1));
+  }
+
+  // Safe from any number of threads.
+  void record(uint64_t us) {
+    buckets[bucketFor(us)].fetch_add(1, std::memory_order_relaxed);
+    sumUs.fetch_add(us, std::memory_order_relaxed);
+  }
+  // Only for histograms with a single writer thread.
+  void recordLocal(uint64_t us) {
+    bump(buckets[bucketFor(us)]);
+    bump(sumUs, us);
+  }
+};
 
+// ----------------------------
+// Metrics
+// ----------------------------
+// Every thread that records gets its own cache-line aligned shard and is its
+// only writer, so updates are plain relaxed stores with no lock and no shared
+// cache line. render() merges the shards on scrape.
+//
+// Per-route stats are indexed by the router's dense route id, so the series
+// are bounded by the route table (plus one for unmatched requests and one
+// for ids past kMaxRoutes) no matter how many distinct URLs clients send.
+// The router reuses the ids of removed routes, so churn does not use them up.
 struct Metrics {
-  std::atomic<uint64_t> total{0}, in_flight{0}, errors{0};
-  std::mutex mu;
-  std::unordered_map<std::string,std::pair<uint64_t,double>> by_route;
+  static constexpr size_t kMaxRoutes = 1024;
 
-  void record(const std::string& key,double ms,bool error){
-    total++; if(error) errors++;
+  Metrics() : instance_(nextInstance().fetch_add(1, std::memory_order_relaxed)) {}
+  Metrics(const Metrics&) = delete;
+  Metrics& operator=(const Metrics&) = delete;
+
+  void enter() { bump(shard().in_flight); }
+  void leave() { bump(shard().in_flight, uint64_t(-1)); }
+
+  // Route templates indexed by route id; called by the router on freeze().
+  // An id that comes back with a new template was freed and handed to a
+  // new route; nothing records under it until this snapshot is published,
+  // so its stats start over here.
+  void setRoutes(const std::vector<std::string>& patterns) {
     std::lock_guard<std::mutex> lk(mu);
-    auto& p=by_route[key]; p.first++; p.second+=ms;
+    for (size_t id = 0; id < std::min({patterns.size(), names_.size(), kMaxRoutes}); id++) {
+      if (patterns[id].empty() || patterns[id] == names_[id]) continue;
+      for (auto& sh : shards_)
+        if (RouteStats* rs = sh->routes[id].load(std::memory_order_acquire)) rs->reset();
+    }
+    names_ = patterns;
+  }
+
+  // `route` is the matched route id, or -1 for requests that matched none.
+  void record(int32_t route,double ms,bool error){
+    Shard& sh = shard();
+    bump(sh.total);
+    if (error) bump(sh.errors);
+
+    RouteStats& rs = sh.route(route);
+    rs.latency.recordLocal(uint64_t(ms * 1000.0));
+    if (error) bump(rs.errors);
   }
+
+  // ----------------------------
+  // Named series
+  // ----------------------------
+  // For subsystems off the per-route path (DB pool, caches, ...). Each call
+  // registers the series on first use and returns a reference that stays
+  // valid for the lifetime of the Metrics, so hot paths keep the reference
+  // rather than looking it up again. Updates are atomic from any thread.
+  std::atomic<uint64_t>& counter(const std::string& name) { return named(counters_, name); }
+  std::atomic<int64_t>& gauge(const std::string& name) { return named(gauges_, name); }
+  LatencyHistogram& histogram(const std::string& name) { return named(histograms_, name); }
+
   std::string render(){
+    std::lock_guard<std::mutex> lk(mu);
+    uint64_t total=0, errors=0, inFlight=0;
+    for (auto& sh : shards_) {
+      total += sh->total.load(std::memory_order_relaxed);
+      errors += sh->errors.load(std::memory_order_relaxed);
+      inFlight += sh->in_flight.load(std::memory_order_relaxed);
+    }
     std::string s;
-    s += "http_requests_total " + std::to_string(total.load()) + "\n";
-    s += "http_in_flight " + std::to_string(in_flight.load()) + "\n";
-    s += "http_request_errors_total " + std::to_string(errors.load()) + "\n";
-    for(auto& kv: by_route){
-      s += "http_request_duration_ms{route=\"" + kv.first + "\"} " + std::to_string(kv.second.second) + "\n";
-      s += "http_requests_by_route_total{route=\"" + kv.first + "\"} " + std::to_string(kv.second.first) + "\n";
+    s += "http_requests_total " + std::to_string(total) + "\n";
+    s += "http_in_flight " + std::to_string(int64_t(inFlight)) + "\n";
+    s += "http_request_errors_total " + std::to_string(errors) + "\n";
+
+    // Each family's lines stay together: the per-route error counters go
+    // out after all of the histograms.
+    s += "# TYPE http_request_duration_seconds histogram\n";
+    std::string routeErrorLines = "# TYPE http_request_errors_by_route_total counter\n";
+    const size_t named = std::min(names_.size(), kMaxRoutes);
+    for (size_t id=0; id<named+2; id++) {
+      if (id < named && names_[id].empty()) continue;  // removed route
+      std::array<uint64_t, LatencyHistogram::kBuckets> buckets{};
+      uint64_t sumUs=0, routeErrors=0;
+      for (auto& sh : shards_) {
+        const RouteStats* rs =
+          id < named ? sh->routes[id].load(std::memory_order_acquire)
+          : id == named ? &sh->unmatched : &sh->overflow;
+        if (!rs) continue;
+        for (size_t b=0; b<buckets.size(); b++)
+          buckets[b] += rs->latency.buckets[b].load(std::memory_order_relaxed);
+        sumUs += rs->latency.sumUs.load(std::memory_order_relaxed);
+        routeErrors += rs->errors.load(std::memory_order_relaxed);
+      }
+      if (id > named && std::all_of(buckets.begin(), buckets.end(), [](uint64_t b){ return b == 0; }))
+        continue;  // "other" only shows up once something overflowed
+      const std::string label = "route=\"" +
+        (id < named ? names_[id] : id == named ? "unmatched" : "other") + "\"";
+      renderHistogram(s, "http_request_duration_seconds", label, buckets, sumUs);
+      routeErrorLines += "http_request_errors_by_route_total{" + label + "} " + std::to_string(routeErrors) + "\n";
+    }
+    s += routeErrorLines;
+
+    for (auto& c : counters_)
+      s += "# TYPE " + c.name + " counter\n" + c.name + " " + std::to_string(c.value.load(std::memory_order_relaxed)) + "\n";
+    for (auto& g : gauges_)
+      s += "# TYPE " + g.name + " gauge\n" + g.name + " " + std::to_string(g.value.load(std::memory_order_relaxed)) + "\n";
+    for (auto& h : histograms_) {
+      std::array<uint64_t, LatencyHistogram::kBuckets> buckets{};
+      for (size_t b=0; b<buckets.size(); b++) buckets[b] = h.value.buckets[b].load(std::memory_order_relaxed);
+      s += "# TYPE " + h.name + " histogram\n";
+      renderHistogram(s, h.name, "", buckets, h.value.sumUs.load(std::memory_order_relaxed));
     }
     return s;
   }
+
+ private:
+  template <class T> struct Named { std::string name; T value{}; };
+
+  template <class T>
+  T& named(std::deque<Named<T>>& list, const std::string& name) {
+    std::lock_guard<std::mutex> lk(mu);
+    for (auto& n : list) if (n.name == name) return n.value;
+    list.emplace_back();
+    list.back().name = name;
+    return list.back().value;
+  }
+
+  static void renderHistogram(std::string& s, const std::string& name, const std::string& label,
+                              const std::array<uint64_t, LatencyHistogram::kBuckets>& buckets,
+                              uint64_t sumUs) {
+    const std::string sep = label.empty() ? "" : ",";
+    const std::string braces = label.empty() ? "" : "{" + label + "}";
+    uint64_t cumulative = 0;
+    char le[32];
+    for (size_t b=0; b<buckets.size(); b++) {
+      cumulative += buckets[b];
+      const uint64_t ub = LatencyHistogram::upperBoundUs(b);
+      if (ub == UINT64_MAX) snprintf(le, sizeof(le), "+Inf");
+      else snprintf(le, sizeof(le), "%.6f", double(ub) / 1e6);
+      s += name + "_bucket{" + label + sep + "le=\"" + le + "\"} " + std::to_string(cumulative) + "\n";
+    }
+    snprintf(le, sizeof(le), "%.6f", double(sumUs) / 1e6);
+    s += name + "_sum" + braces + " " + le + "\n";
+    s += name + "_count" + braces + " " + std::to_string(cumulative) + "\n";
+  }
+
+  struct RouteStats {
+    LatencyHistogram latency;
+    std::atomic<uint64_t> errors{0};
+
+    void reset() {
+      for (auto& b : latency.buckets) b.store(0, std::memory_order_relaxed);
+      latency.sumUs.store(0, std::memory_order_relaxed);
+      errors.store(0, std::memory_order_relaxed);
+    }
+  };
+
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> total{0}, errors{0}, in_flight{0};
+    // Indexed by route id; a route's stats are allocated the first time
+    // this shard's thread serves it.
+    std::array<std::atomic<RouteStats*>, kMaxRoutes> routes{};
+    RouteStats unmatched, overflow;
+
+    ~Shard() { for (auto& r : routes) delete r.load(std::memory_order_relaxed); }
+
+    RouteStats& route(int32_t id) {
+      if (id < 0) return unmatched;
+      if (size_t(id) >= kMaxRoutes) return overflow;
+      RouteStats* rs = routes[id].load(std::memory_order_relaxed);
+      if (!rs) { rs = new RouteStats(); routes[id].store(rs, std::memory_order_release); }
+      return *rs;
+    }
+  };
+
+  static std::atomic<uint64_t>& nextInstance() { static std::atomic<uint64_t> n{0}; return n; }
+
+  // Shards are keyed by instance id rather than address so a thread never
+  // picks up a stale shard from a destroyed Metrics. A thread's shard stays
+  // owned by the Metrics after the thread exits so its counts are kept.
+  Shard& shard() {
+    struct Slot { uint64_t instance; Shard* shard; };
+    static thread_local std::vector<Slot> slots;
+    static thread_local Slot last{UINT64_MAX, nullptr};
+    if (last.instance == instance_) return *last.shard;
+    for (auto& sl : slots) if (sl.instance == instance_) { last = sl; return *sl.shard; }
+
+    std::lock_guard<std::mutex> lk(mu);
+    shards_.push_back(std::make_unique<Shard>());
+    last = {instance_, shards_.back().get()};
+    slots.push_back(last);
+    return *last.shard;
+  }
+
+  const uint64_t instance_;
+  std::mutex mu;  // guards registration of shards, names_ and named series
+  std::vector<std::string> names_;
+  std::deque<Named<std::atomic<uint64_t>>> counters_;
+  std::deque<Named<std::atomic<int64_t>>> gauges_;
+  std::deque<Named<LatencyHistogram>> histograms_;
+  std::vector<std::unique_ptr<Shard>> shards_;
 };
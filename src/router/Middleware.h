@@ -1,9 +1,33 @@
 #pragma once
 #include <functional>
+#include <vector>
 #include "RouteContext.h"
 #include "Response.h"
 
+struct CompressionOptions;
+struct Metrics;
+class AccessLog;
+
 struct Middleware {
+  // Built-ins are dispatched through a switch on the hot path rather than
+  // through std::function; only Custom uses before/after.
+  enum class Kind : uint8_t { Custom, Cors, Compression, RequestId };
+
+  Kind kind = Kind::Custom;
   std::function<bool(RouteContext&, Res&)> before; // return true to short-circuit
   std::function<void(const RouteContext&, Res&)> after;
+  const CompressionOptions* compression = nullptr;  // Kind::Compression
+  Metrics* metrics = nullptr;                        // Kind::RequestId
+  AccessLog* accessLog = nullptr;                    // Kind::RequestId
+
+  bool hasBefore() const { return kind==Kind::Custom ? bool(before) : kind!=Kind::Compression; }
+  bool hasAfter() const { return kind==Kind::Custom ? bool(after) : true; }
+};
+
+// The middleware that applies to a route, already filtered by scope and
+// split into before/after lists. Built once on freeze(), shared read-only by
+// every route with the same set of scopes.
+struct MiddlewareChain {
+  std::vector<const Middleware*> before;
+  std::vector<const Middleware*> after;
 };
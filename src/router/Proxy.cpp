@@ -0,0 +1,354 @@
+#include "Proxy.h"
+
+#include <proxygen/lib/http/HTTPConnector.h>
+#include <proxygen/lib/http/session/HTTPTransaction.h>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+// ============================================================================
+// UpstreamGroup
+// ============================================================================
+
+UpstreamGroup::UpstreamGroup(const std::vector<std::string>& upstreams, ProxyOptions opts,
+                             Metrics* metrics)
+    : opts_(std::move(opts)), metrics_(metrics) {
+  if (upstreams.empty()) throw std::invalid_argument("proxy route needs at least one upstream");
+  for (auto& hp : upstreams) {
+    auto colon = hp.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon+1 == hp.size())
+      throw std::invalid_argument("upstream must be host:port: " + hp);
+    auto u = std::make_unique<Upstream>();
+    u->addr.setFromHostPort(hp.substr(0, colon), uint16_t(std::stoul(hp.substr(colon+1))));
+    upstreams_.push_back(std::move(u));
+  }
+  if (metrics_) {
+    errors_ = &metrics_->counter("proxy_upstream_errors_total");
+    ejected_ = &metrics_->counter("proxy_upstream_ejections_total");
+    connects_ = &metrics_->counter("proxy_upstream_connects_total");
+  }
+}
+
+int64_t UpstreamGroup::nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t UpstreamGroup::pick() {
+  static thread_local std::minstd_rand rng{std::random_device{}()};
+  const int64_t now = nowMs();
+  const size_t n = upstreams_.size();
+  // Two distinct random candidates, preferring ones in rotation; if every
+  // upstream is ejected, any will do.
+  size_t a = rng() % n, b = n > 1 ? (a + 1 + rng() % (n-1)) % n : a;
+  for (size_t tries = 0; tries < n && !inRotation(*upstreams_[a], now); tries++) a = (a + 1) % n;
+  for (size_t tries = 0; tries < n && (b == a || !inRotation(*upstreams_[b], now)); tries++) b = (b + 1) % n;
+  if (!inRotation(*upstreams_[b], now)) b = a;
+  const size_t i = upstreams_[b]->outstanding.load(std::memory_order_relaxed) <
+                   upstreams_[a]->outstanding.load(std::memory_order_relaxed) ? b : a;
+  upstreams_[i]->outstanding.fetch_add(1, std::memory_order_relaxed);
+  return i;
+}
+
+void UpstreamGroup::finished(size_t i, bool ok) {
+  Upstream& u = *upstreams_[i];
+  u.outstanding.fetch_sub(1, std::memory_order_relaxed);
+  if (ok) {
+    u.failures.store(0, std::memory_order_relaxed);
+    u.ejections.store(0, std::memory_order_relaxed);
+    return;
+  }
+  if (errors_) errors_->fetch_add(1, std::memory_order_relaxed);
+  if (u.failures.fetch_add(1, std::memory_order_relaxed) + 1 < opts_.ejectAfterFailures) return;
+
+  const int64_t now = nowMs();
+  if (!inRotation(u, now)) return;
+  size_t out = 0;
+  for (auto& o : upstreams_) out += !inRotation(*o, now);
+  if ((out + 1) * 100 > upstreams_.size() * opts_.maxEjectedPercent) return;
+
+  const uint32_t k = std::min<uint32_t>(u.ejections.fetch_add(1, std::memory_order_relaxed), 20);
+  const int64_t ms = std::min<int64_t>(opts_.ejectBase.count() << k, opts_.ejectMax.count());
+  u.ejectedUntilMs.store(now + ms, std::memory_order_relaxed);
+  u.failures.store(0, std::memory_order_relaxed);
+  if (ejected_) ejected_->fetch_add(1, std::memory_order_relaxed);
+}
+
+UpstreamGroup::Loop& UpstreamGroup::loop(folly::EventBase& evb) {
+  return loops_.try_emplace_with(evb, [&] {
+    Loop l;
+    l.timer = folly::HHWheelTimer::newTimer(
+      &evb, folly::HHWheelTimer::DEFAULT_TICK_INTERVAL,
+      folly::AsyncTimeout::InternalEnum::NORMAL, opts_.idleTimeout);
+    for (size_t i = 0; i < upstreams_.size(); i++)
+      l.pools.push_back(std::make_unique<proxygen::SessionPool>(nullptr, opts_.maxIdleSessions));
+    return l;
+  });
+}
+
+proxygen::SessionPool& UpstreamGroup::sessions(folly::EventBase& evb, size_t i) {
+  return *loop(evb).pools[i];
+}
+
+folly::HHWheelTimer& UpstreamGroup::timer(folly::EventBase& evb) {
+  return *loop(evb).timer;
+}
+
+// ============================================================================
+// ProxyHandler
+// ============================================================================
+
+namespace {
+
+// Forwards one request to an upstream and streams both bodies through as
+// they arrive, with flow control in both directions: when the upstream
+// stops taking bytes the client's ingress is paused, and the other way
+// round. Nothing is buffered except body chunks that arrive while the
+// upstream connection is still being opened (client ingress is paused
+// meanwhile, so that is at most one read's worth).
+//
+// Two sides with their own lifetimes: proxygen's downstream (this
+// RequestHandler) and the upstream transaction (Upstream below). The
+// handler deletes itself once both are done.
+class ProxyHandler : public proxygen::RequestHandler {
+ public:
+  ProxyHandler(std::shared_ptr<UpstreamGroup> group, std::string_view forwardPath,
+               ConcurrencyLimiter* limiter, int32_t routeId, std::shared_ptr<const void> routeIds)
+    : group_(std::move(group)), forwardPath_(forwardPath), limiter_(limiter),
+      routeId_(routeId), routeIds_(std::move(routeIds)), start_(std::chrono::steady_clock::now()), upstream_(*this) {}
+
+  void onRequest(std::unique_ptr<proxygen::HTTPMessage> msg) noexcept override {
+    evb_ = folly::EventBaseManager::get()->getEventBase();
+    request_ = upstreamRequest(*msg);
+    upstreamIdx_ = group_->pick();
+    picked_ = true;
+    if (auto* txn = group_->sessions(*evb_, upstreamIdx_).getTransaction(&upstream_)) {
+      start(txn);
+      return;
+    }
+    downstream_->pauseIngress();
+    dial();
+  }
+
+  void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+    if (txn_) txn_->sendBody(std::move(body));
+    else if (!finished_) pending_.append(std::move(body));
+  }
+
+  void onEOM() noexcept override {
+    if (txn_) txn_->sendEOM();
+    else pendingEOM_ = true;
+  }
+
+  void onUpgrade(proxygen::UpgradeProtocol) noexcept override {}
+
+  // Client connection is slow to drain: stop reading from the upstream.
+  void onEgressPaused() noexcept override { if (txn_) txn_->pauseIngress(); }
+  void onEgressResumed() noexcept override { if (txn_) txn_->resumeIngress(); }
+
+  void requestComplete() noexcept override {
+    downstreamDone_ = true;
+    maybeDelete();
+  }
+
+  void onError(proxygen::ProxygenError) noexcept override {
+    downstreamDone_ = true;
+    finish(Outcome::Aborted);
+    if (txn_) {
+      txn_->sendAbort();  // detachTransaction() finishes the cleanup
+      return;
+    }
+    maybeDelete();
+  }
+
+ private:
+  // proxygen's client-side callbacks for the upstream transaction.
+  class Upstream : public proxygen::HTTPTransactionHandler {
+   public:
+    explicit Upstream(ProxyHandler& h) : h_(h) {}
+
+    void setTransaction(proxygen::HTTPTransaction* txn) noexcept override { h_.txn_ = txn; }
+    void detachTransaction() noexcept override {
+      h_.txn_ = nullptr;
+      h_.maybeDelete();
+    }
+    void onHeadersComplete(std::unique_ptr<proxygen::HTTPMessage> msg) noexcept override {
+      h_.onUpstreamHeaders(std::move(msg));
+    }
+    void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override {
+      if (!h_.downstreamDone_) h_.downstream_->sendBody(std::move(body));
+    }
+    void onTrailers(std::unique_ptr<proxygen::HTTPHeaders>) noexcept override {}
+    void onEOM() noexcept override {
+      if (!h_.downstreamDone_) h_.downstream_->sendEOM();
+      h_.finish(h_.status_ < 500 ? Outcome::Ok : Outcome::Failed);
+    }
+    void onUpgrade(proxygen::UpgradeProtocol) noexcept override {}
+    void onError(const proxygen::HTTPException&) noexcept override { h_.onUpstreamError(); }
+    // Upstream is slow to take the request body: stop reading it from the client.
+    void onEgressPaused() noexcept override { if (!h_.downstreamDone_) h_.downstream_->pauseIngress(); }
+    void onEgressResumed() noexcept override { if (!h_.downstreamDone_) h_.downstream_->resumeIngress(); }
+
+   private:
+    ProxyHandler& h_;
+  };
+
+  // Opens a new keep-alive connection; it joins the loop's pool and this
+  // request takes the first transaction on it.
+  class Dial : public proxygen::HTTPConnector::Callback {
+   public:
+    // Holds its own reference to the group: the handler may be gone by the
+    // time the connect completes.
+    Dial(ProxyHandler* h, std::shared_ptr<UpstreamGroup> group, folly::EventBase& evb, size_t idx)
+      : h_(h), group_(std::move(group)), evb_(evb), idx_(idx), connector_(this, &group_->timer(evb)) {}
+
+    void start() {
+      group_->countConnect();
+      connector_.connect(&evb_, group_->address(idx_), group_->options().connectTimeout);
+    }
+    void cancel() { h_ = nullptr; }
+
+    void connectSuccess(proxygen::HTTPUpstreamSession* session) override {
+      auto& pool = group_->sessions(evb_, idx_);
+      pool.putSession(session);
+      if (h_) h_->dialed(pool.getTransaction(&h_->upstream_));
+      delete this;
+    }
+    void connectError(const folly::AsyncSocketException&) override {
+      if (h_) h_->dialed(nullptr);
+      delete this;
+    }
+
+   private:
+    ProxyHandler* h_;
+    std::shared_ptr<UpstreamGroup> group_;
+    folly::EventBase& evb_;
+    size_t idx_;
+    proxygen::HTTPConnector connector_;
+  };
+
+  std::unique_ptr<proxygen::HTTPMessage> upstreamRequest(const proxygen::HTTPMessage& in) {
+    auto out = std::make_unique<proxygen::HTTPMessage>(in);
+    out->stripPerHopHeaders();
+    std::string url(forwardPath_.empty() || forwardPath_[0] != '/' ? "/" : "");
+    url += forwardPath_;
+    if (!in.getQueryString().empty()) { url += '?'; url += in.getQueryString(); }
+    out->setURL(std::move(url));
+    auto& h = out->getHeaders();
+    std::string xff(h.getSingleOrEmpty(proxygen::HTTP_HEADER_X_FORWARDED_FOR));
+    xff += xff.empty() ? "" : ", ";
+    xff += in.getClientIP();
+    h.set(proxygen::HTTP_HEADER_X_FORWARDED_FOR, xff);
+    return out;
+  }
+
+  void dial() {
+    dial_ = new Dial(this, group_, *evb_, upstreamIdx_);
+    dial_->start();
+  }
+
+  void dialed(proxygen::HTTPTransaction* txn) {
+    dial_ = nullptr;
+    if (!txn) {
+      respondError(502, "Bad Gateway");
+      return;
+    }
+    start(txn);
+    downstream_->resumeIngress();
+  }
+
+  void start(proxygen::HTTPTransaction* txn) {
+    txn_ = txn;
+    txn_->sendHeaders(*request_);
+    request_.reset();
+    if (auto body = pending_.move()) txn_->sendBody(std::move(body));
+    if (pendingEOM_) txn_->sendEOM();
+  }
+
+  void onUpstreamHeaders(std::unique_ptr<proxygen::HTTPMessage> msg) {
+    status_ = msg->getStatusCode();
+    if (downstreamDone_) return;
+    msg->stripPerHopHeaders();
+    headersSent_ = true;
+    downstream_->sendHeaders(*msg);
+  }
+
+  void onUpstreamError() {
+    if (downstreamDone_) { finish(Outcome::Aborted); return; }
+    if (!headersSent_) { respondError(502, "Bad Gateway"); return; }
+    finish(Outcome::Failed);
+    downstream_->sendAbort();
+  }
+
+  // Nothing (or nothing usable) came back from the upstream. Client
+  // ingress may be paused (while dialing, or by upstream flow control):
+  // resume it so the rest of the request is read and dropped and
+  // requestComplete() arrives, instead of the transaction (and any
+  // pipelined requests behind it) hanging until the idle timeout.
+  void respondError(uint16_t code, const char* msg) {
+    status_ = code;
+    finish(Outcome::Failed);
+    headersSent_ = true;
+    downstream_->resumeIngress();  // first: sending may complete the request
+    proxygen::ResponseBuilder(downstream_).status(code, msg).body("upstream unavailable\n").sendWithEOM();
+  }
+
+  // Failed counts against the upstream; Aborted (the client went away) is
+  // nobody's fault and is not sampled for admission either.
+  enum class Outcome { Ok, Failed, Aborted };
+
+  // Accounting, once per request: upstream outcome, admission slot, metrics.
+  void finish(Outcome o) {
+    if (finished_) return;
+    finished_ = true;
+    if (picked_) {
+      if (o == Outcome::Aborted) group_->release(upstreamIdx_);
+      else group_->finished(upstreamIdx_, o == Outcome::Ok);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start_;
+    if (limiter_) limiter_->release(elapsed, o != Outcome::Aborted);
+    if (auto* m = group_->metrics())
+      m->record(routeId_, std::chrono::duration<double, std::milli>(elapsed).count(),
+                o == Outcome::Failed);
+    pending_.move();
+  }
+
+  void maybeDelete() {
+    if (!downstreamDone_ || txn_) return;
+    if (dial_) { dial_->cancel(); dial_ = nullptr; }
+    delete this;
+  }
+
+  std::shared_ptr<UpstreamGroup> group_;
+  std::string_view forwardPath_;
+  ConcurrencyLimiter* limiter_;
+  int32_t routeId_;
+  std::shared_ptr<const void> routeIds_;
+  std::chrono::steady_clock::time_point start_;
+  Upstream upstream_;
+  folly::EventBase* evb_ = nullptr;
+  std::unique_ptr<proxygen::HTTPMessage> request_;  // until it is sent
+  folly::IOBufQueue pending_{folly::IOBufQueue::cacheChainLength()};
+  proxygen::HTTPTransaction* txn_ = nullptr;
+  Dial* dial_ = nullptr;
+  size_t upstreamIdx_ = 0;
+  uint16_t status_ = 0;
+  bool picked_ = false;
+  bool pendingEOM_ = false;
+  bool headersSent_ = false;
+  bool downstreamDone_ = false;
+  bool finished_ = false;
+};
+
+} // namespace
+
+proxygen::RequestHandler* newProxyHandler(std::shared_ptr<UpstreamGroup> group,
+                                          std::string_view forwardPath,
+                                          ConcurrencyLimiter* limiter, int32_t routeId,
+                                          std::shared_ptr<const void> routeIds) {
+  return new ProxyHandler(std::move(group), forwardPath, limiter, routeId, std::move(routeIds));
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <folly/SocketAddress.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/EventBaseLocal.h>
+#include <folly/io/async/HHWheelTimer.h>
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/lib/http/connpool/SessionPool.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Admission.h"
+#include "Metrics.h"
+
+struct ProxyOptions {
+  std::chrono::milliseconds connectTimeout{1000};
+  // An upstream exchange with no bytes moving for this long is aborted.
+  std::chrono::milliseconds idleTimeout{30000};
+  uint32_t maxIdleSessions = 64;  // per upstream, per EventBase
+  // Forward only what the route's trailing wildcard matched ("/svc/*rest"
+  // sends /svc/a/b upstream as /a/b); false forwards the path unchanged.
+  bool stripPrefix = true;
+  // Passive outlier ejection: an upstream that fails this many requests in a
+  // row (connect error, reset, 5xx) is taken out of rotation for ejectBase,
+  // doubling each time it is ejected again without a success in between, up
+  // to ejectMax. At most maxEjectedPercent of the upstreams are out at once.
+  uint32_t ejectAfterFailures = 5;
+  std::chrono::milliseconds ejectBase{10000};
+  std::chrono::milliseconds ejectMax{300000};
+  uint32_t maxEjectedPercent = 50;
+  std::string admissionClass = "default";
+};
+
+// ----------------------------
+// Upstream set
+// ----------------------------
+// The upstreams of one proxy route. Request counts and ejection state are
+// shared by all threads; keep-alive sessions are pooled per EventBase, so a
+// session is only ever used on the loop that opened it.
+class UpstreamGroup {
+ public:
+  // `upstreams` as "host:port"; throws std::invalid_argument on a bad one.
+  UpstreamGroup(const std::vector<std::string>& upstreams, ProxyOptions opts, Metrics* metrics);
+  UpstreamGroup(const UpstreamGroup&) = delete;
+  UpstreamGroup& operator=(const UpstreamGroup&) = delete;
+
+  // Power of two choices: of two random upstreams in rotation, the one with
+  // fewer outstanding requests. Counts the request as outstanding on it.
+  size_t pick();
+  // Ends a request started by pick(). `ok` = false for connect errors,
+  // resets and 5xx; feeds outlier ejection.
+  void finished(size_t i, bool ok);
+  // Ends a request that says nothing about the upstream (client went away).
+  void release(size_t i) { upstreams_[i]->outstanding.fetch_sub(1, std::memory_order_relaxed); }
+
+  const folly::SocketAddress& address(size_t i) const { return upstreams_[i]->addr; }
+  const ProxyOptions& options() const { return opts_; }
+  Metrics* metrics() const { return metrics_; }
+
+  // This loop's keep-alive sessions to upstream `i`, and the timer its
+  // connections and transactions time out on.
+  proxygen::SessionPool& sessions(folly::EventBase& evb, size_t i);
+  folly::HHWheelTimer& timer(folly::EventBase& evb);
+
+  void countConnect() { if (connects_) connects_->fetch_add(1, std::memory_order_relaxed); }
+
+ private:
+  struct Upstream {
+    folly::SocketAddress addr;
+    std::atomic<int64_t> outstanding{0};
+    std::atomic<uint32_t> failures{0};   // consecutive
+    std::atomic<uint32_t> ejections{0};  // since the last success
+    std::atomic<int64_t> ejectedUntilMs{0};
+  };
+  struct Loop {
+    folly::HHWheelTimer::UniquePtr timer;
+    std::vector<std::unique_ptr<proxygen::SessionPool>> pools;
+  };
+
+  static int64_t nowMs();
+  bool inRotation(const Upstream& u, int64_t now) const { return u.ejectedUntilMs.load(std::memory_order_relaxed) <= now; }
+  Loop& loop(folly::EventBase& evb);
+
+  ProxyOptions opts_;
+  Metrics* metrics_;
+  std::vector<std::unique_ptr<Upstream>> upstreams_;
+  folly::EventBaseLocal<Loop> loops_;
+  std::atomic<uint64_t>* errors_ = nullptr;
+  std::atomic<uint64_t>* ejected_ = nullptr;
+  std::atomic<uint64_t>* connects_ = nullptr;
+};
+
+// Handler for one proxied request. `forwardPath` is the path to send
+// upstream (without query) and must stay valid as long as the request
+// message; `limiter` is the admission slot taken for it, if any. `routeIds`
+// is held until the request is done so `routeId` is not given to another
+// route meanwhile.
+proxygen::RequestHandler* newProxyHandler(std::shared_ptr<UpstreamGroup> group,
+                                          std::string_view forwardPath,
+                                          ConcurrencyLimiter* limiter, int32_t routeId,
+                                          std::shared_ptr<const void> routeIds);
@@ -0,0 +1,124 @@
+#pragma once
+#include <folly/synchronization/Hazptr.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// ----------------------------
+// Published<T>
+// ----------------------------
+// An immutable T that writers replace wholesale and many threads read.
+// publish() swaps in a new version; readers pin() the current one and keep
+// it alive for as long as they hold the Ref, so a version goes away only
+// once the last request using it is done.
+//
+// Read side: one acquire load of a shared version number that only
+// changes on publish, plus thread-local (non-atomic) refcounting. A thread
+// that sees a new version copies it out under a hazard pointer, once per
+// version; there is no lock and no shared write on any read path.
+//
+// A Ref must be released on the thread that took it (handlers are created
+// and destroyed on their EventBase thread).
+template <class T>
+class Published {
+  struct Pin {
+    std::shared_ptr<const T> value;
+    uint64_t version;
+    uint32_t users;
+  };
+
+ public:
+  class Ref {
+   public:
+    Ref() = default;
+    Ref(Ref&& o) noexcept : pin_(std::exchange(o.pin_, nullptr)) {}
+    Ref& operator=(Ref&& o) noexcept { reset(); pin_ = std::exchange(o.pin_, nullptr); return *this; }
+    ~Ref() { reset(); }
+
+    const T* get() const { return pin_ ? pin_->value.get() : nullptr; }
+    const T& operator*() const { return *pin_->value; }
+    const T* operator->() const { return pin_->value.get(); }
+    explicit operator bool() const { return pin_ != nullptr; }
+
+   private:
+    friend class Published;
+    explicit Ref(Pin* p) : pin_(p) { p->users++; }
+    void reset() { if (pin_) unref(std::exchange(pin_, nullptr)); }
+    Pin* pin_ = nullptr;
+  };
+
+  Published() : instance_(nextInstance().fetch_add(1, std::memory_order_relaxed)) {}
+  Published(const Published&) = delete;
+  Published& operator=(const Published&) = delete;
+  ~Published() {
+    if (auto* n = head_.load(std::memory_order_acquire)) n->retire();
+  }
+
+  // Makes `value` the current version. Writers are serialized.
+  void publish(std::shared_ptr<const T> value) {
+    std::lock_guard<std::mutex> lk(writeMu_);
+    auto* n = new Node;
+    n->value = std::move(value);
+    n->version = version_.load(std::memory_order_relaxed) + 1;
+    Node* old = head_.exchange(n, std::memory_order_acq_rel);
+    version_.store(n->version, std::memory_order_release);
+    if (old) old->retire();
+  }
+
+  // Current version; an empty Ref until the first publish().
+  Ref pin() const {
+    const uint64_t v = version_.load(std::memory_order_acquire);
+    if (v == 0) return Ref();
+    Slot& s = slot();
+    if (!s.pin || s.pin->version != v) {
+      auto* p = new Pin{load(), v, 1};
+      if (s.pin) unref(s.pin);
+      s.pin = p;
+    }
+    return Ref(s.pin);
+  }
+
+ private:
+  struct Node : folly::hazptr_obj_base<Node> {
+    std::shared_ptr<const T> value;
+    uint64_t version = 0;
+  };
+
+  // One per thread and instance: the thread's pin on the latest version it
+  // has seen (holding one reference of its own).
+  struct Slot {
+    uint64_t instance;
+    Pin* pin = nullptr;
+  };
+  struct Slots {
+    std::vector<Slot> list;
+    ~Slots() { for (auto& s : list) if (s.pin) unref(s.pin); }
+  };
+
+  static void unref(Pin* p) { if (--p->users == 0) delete p; }
+
+  std::shared_ptr<const T> load() const {
+    auto h = folly::make_hazard_pointer<>();
+    Node* n = h.protect(head_);
+    return n->value;
+  }
+
+  // Keyed by instance id rather than address, like the Metrics shards, so a
+  // thread never picks up a pin left behind by a destroyed instance.
+  Slot& slot() const {
+    static thread_local Slots slots;
+    for (auto& s : slots.list) if (s.instance == instance_) return s;
+    slots.list.push_back({instance_, nullptr});
+    return slots.list.back();
+  }
+
+  static std::atomic<uint64_t>& nextInstance() { static std::atomic<uint64_t> n{0}; return n; }
+
+  const uint64_t instance_;
+  std::atomic<Node*> head_{nullptr};
+  std::atomic<uint64_t> version_{0};  // head_'s version, 0 before the first publish
+  std::mutex writeMu_;
+};
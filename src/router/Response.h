@@ -1,33 +1,165 @@
 #pragma once
 #include <proxygen/httpserver/ResponseBuilder.h>
+#include <proxygen/lib/http/HTTPCommonHeaders.h>
+#include <folly/futures/Future.h>
+#include <folly/io/IOBuf.h>
+#include <folly/small_vector.h>
 #include <nlohmann/json.hpp>
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include "JsonWriter.h"
 #include "RouteContext.h"
 
+// Response under construction. Headers live in a small inline vector keyed
+// by proxygen's HTTPHeaderCode (names are only stored for uncommon
+// headers), and the body is always an IOBuf chain handed to proxygen as-is:
+// json() dumps into a string the IOBuf then owns, body() takes ownership or
+// a clone of a shared/cached buffer, staticBody() wraps memory that
+// outlives the response without copying it.
 class Res {
  public:
   explicit Res(proxygen::ResponseBuilder& rb, RouteContext& ctx)
     : rb_(&rb), ctx_(&ctx) {}
 
   Res& status(uint16_t code, std::string msg="OK") { code_=code; msg_=std::move(msg); return *this; }
-  Res& header(const std::string& k,const std::string& v){ headers_[k]=v; return *this; }
-  Res& text(const std::string& s,uint16_t code=200){ code_=code; headers_["content-type"]="text/plain"; body_=s; return *this; }
-  Res& json(const nlohmann::json& j,uint16_t code=200,bool pretty=false){ code_=code; headers_["content-type"]="application/json"; body_=j.dump(pretty?2:-1); return *this; }
+
+  // Sets (replaces) a header.
+  Res& header(proxygen::HTTPHeaderCode code, std::string v) {
+    if (auto* h = find(code)) { h->value = std::move(v); h->byHandler = byHandler_; }
+    else headers_.push_back({code, {}, std::move(v), byHandler_});
+    return *this;
+  }
+  Res& header(std::string_view name, std::string v) {
+    auto code = intern(name);
+    if (code != proxygen::HTTP_HEADER_OTHER) return header(code, std::move(v));
+    if (auto* h = find(name)) { h->value = std::move(v); h->byHandler = byHandler_; }
+    else headers_.push_back({code, std::string(name), std::move(v), byHandler_});
+    return *this;
+  }
+  // Value of a header set on this response, empty if unset.
+  std::string_view header(proxygen::HTTPHeaderCode code) const {
+    auto* h = const_cast<Res*>(this)->find(code);
+    return h ? std::string_view(h->value) : std::string_view();
+  }
+  bool hasHeader(proxygen::HTTPHeaderCode code) const { return const_cast<Res*>(this)->find(code); }
+
+  Res& text(std::string s,uint16_t code=200){
+    code_=code; header(proxygen::HTTP_HEADER_CONTENT_TYPE,"text/plain");
+    bodyBuf_=folly::IOBuf::fromString(std::move(s)); return *this;
+  }
+  Res& json(const nlohmann::json& j,uint16_t code=200,bool pretty=false){
+    code_=code; header(proxygen::HTTP_HEADER_CONTENT_TYPE,"application/json");
+    bodyBuf_=jsonToIOBuf(j,pretty); return *this;
+  }
+
+  // Body as an IOBuf chain (owned, or a clone() sharing a cached buffer).
+  Res& body(std::unique_ptr<folly::IOBuf> b){ bodyBuf_=std::move(b); return *this; }
+  // Body from memory that outlives the response (string literals, static
+  // tables); wrapped, not copied.
+  Res& staticBody(std::string_view s){
+    bodyBuf_=folly::IOBuf::wrapBuffer(s.data(), s.size()); return *this;
+  }
+
+  // The body is final as is (a byte range, a precompressed file): the
+  // compression middleware leaves it alone.
+  Res& keepEncoding(){ keepEncoding_=true; return *this; }
+  bool keepsEncoding() const { return keepEncoding_; }
+
+  // Finish the response later. The handler returns right away; once `work`
+  // completes (back on the request's EventBase) the after-middlewares run
+  // and the response is sent. `work` fills in this Res itself, and a
+  // failure turns into a 500 (503 on folly::FutureTimeout or WorkerPoolFull).
+  Res& defer(folly::SemiFuture<folly::Unit> work){ deferred_=std::move(work); return *this; }
+  bool deferred() const { return deferred_.has_value(); }
+  folly::SemiFuture<folly::Unit> takeDeferred(){ auto f=std::move(*deferred_); deferred_.reset(); return f; }
 
   void send() {
     rb_->status(code_, msg_);
-    for (auto& kv : headers_) rb_->header(kv.first, kv.second);
-    rb_->body(body_);
+    for (auto& h : headers_) {
+      if (h.code != proxygen::HTTP_HEADER_OTHER) rb_->header(h.code, h.value);
+      else rb_->header(h.name, h.value);
+    }
+    if (bodyBuf_) rb_->body(std::move(bodyBuf_));
     rb_->sendWithEOM();
   }
 
-  uint16_t& code(){return code_;} std::string& body(){return body_;}
-  std::unordered_map<std::string,std::string>& headers(){return headers_;}
+  // Headers set from here on belong to the handler rather than to the
+  // before-middleware; only those go into a snapshot().
+  void handlerStarts(){ byHandler_=true; }
+
+  // Copy of status, handler-set headers and body (the body buffer is
+  // shared, not copied), e.g. to answer identical requests with the same
+  // result. restore() applies it over this response's own headers, so a
+  // request keeps what its before-middleware set (its x-request-id, say).
+  struct Snapshot;
+  std::shared_ptr<const Snapshot> snapshot() const;
+  void restore(const Snapshot& s);
+
+  uint16_t& code(){return code_;}
+  const folly::IOBuf* bodyBuf() const {return bodyBuf_.get();}
+  size_t bodyLength() const { return bodyBuf_ ? bodyBuf_->computeChainDataLength() : 0; }
   const RouteContext& ctx() const {return *ctx_;}
 
  private:
+  struct Header {
+    proxygen::HTTPHeaderCode code;
+    std::string name;  // only for HTTP_HEADER_OTHER
+    std::string value;
+    bool byHandler;
+  };
+
+  static proxygen::HTTPHeaderCode intern(std::string_view name) {
+    return proxygen::HTTPCommonHeaders::hash(name.data(), name.size());
+  }
+  Header* find(proxygen::HTTPHeaderCode code) {
+    for (auto& h : headers_) if (h.code == code) return &h;
+    return nullptr;
+  }
+  Header* find(std::string_view name) {
+    for (auto& h : headers_)
+      if (h.code == proxygen::HTTP_HEADER_OTHER && h.name.size() == name.size() &&
+          std::equal(name.begin(), name.end(), h.name.begin(),
+                     [](char a, char b){ return ::tolower((unsigned char)a) == ::tolower((unsigned char)b); }))
+        return &h;
+    return nullptr;
+  }
+
   proxygen::ResponseBuilder* rb_;
   RouteContext* ctx_;
   uint16_t code_{200}; std::string msg_{"OK"};
-  std::unordered_map<std::string,std::string> headers_;
-  std::string body_;
+  folly::small_vector<Header, 8> headers_;
+  std::unique_ptr<folly::IOBuf> bodyBuf_;
+  bool keepEncoding_ = false;
+  bool byHandler_ = false;
+  std::optional<folly::SemiFuture<folly::Unit>> deferred_;
 };
+
+struct Res::Snapshot {
+  uint16_t code;
+  std::string msg;
+  folly::small_vector<Header, 8> headers;
+  std::unique_ptr<folly::IOBuf> body;
+  bool keepEncoding;
+};
+
+inline std::shared_ptr<const Res::Snapshot> Res::snapshot() const {
+  auto s = std::make_shared<Snapshot>(
+    Snapshot{code_, msg_, {}, bodyBuf_ ? bodyBuf_->clone() : nullptr, keepEncoding_});
+  for (auto& h : headers_) if (h.byHandler) s->headers.push_back(h);
+  return s;
+}
+
+inline void Res::restore(const Snapshot& s) {
+  code_ = s.code;
+  msg_ = s.msg;
+  for (auto& h : s.headers) {
+    if (h.code != proxygen::HTTP_HEADER_OTHER) header(h.code, h.value);
+    else header(h.name, h.value);
+  }
+  bodyBuf_ = s.body ? s.body->clone() : nullptr;
+  keepEncoding_ = s.keepEncoding;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <folly/io/IOBuf.h>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "Compression.h"
+
+// Stored response of a route marked cacheable(): the body as the handler
+// produced it plus pre-encoded br/gzip variants, each with its own strong
+// ETag. Filled once by the first request that reaches the handler, then
+// read by every thread; entries are immutable and buffers are only ever
+// cloned (refcount bump), never copied.
+class ResponseCache {
+ public:
+  struct Variant {
+    std::unique_ptr<folly::IOBuf> body;  // nullptr: not worth encoding
+    std::string etag;                    // quoted, e.g. "\"3f2a...-br\""
+  };
+  struct Entry {
+    std::string contentType;
+    Variant identity, gzip, brotli;
+    bool negotiate = false;  // variants exist, responses Vary on Accept-Encoding
+
+    const Variant& pick(Encoding e) const {
+      if (e == Encoding::Brotli && brotli.body) return brotli;
+      if (e == Encoding::Gzip && gzip.body) return gzip;
+      return identity;
+    }
+  };
+
+  ResponseCache() = default;
+  ResponseCache(const ResponseCache&) = delete;
+  ResponseCache& operator=(const ResponseCache&) = delete;
+  ~ResponseCache() { delete entry_.load(std::memory_order_acquire); }
+
+  const Entry* get() const { return entry_.load(std::memory_order_acquire); }
+
+  // Builds the entry from a handler's output. `compression` (the route's
+  // compression options, if it has any) decides whether variants are made;
+  // they are encoded once at the configured maximum level. If another
+  // thread stored first, its entry wins and is returned.
+  const Entry* store(std::string contentType, const folly::IOBuf& body,
+                     const CompressionOptions* compression) {
+    auto e = std::make_unique<Entry>();
+    e->contentType = std::move(contentType);
+    auto flat = body.cloneCoalescedAsValue();
+    const std::string base = hash(flat);
+    e->identity = {folly::IOBuf::copyBuffer(flat.data(), flat.length()), quote(base, "")};
+    if (compression && flat.length() >= compression->minBytes &&
+        isCompressible(e->contentType, *compression)) {
+      e->gzip = encoded(Encoding::Gzip, flat, compression->gzipLevel, base, "-gz");
+      e->brotli = encoded(Encoding::Brotli, flat, compression->brotliQuality, base, "-br");
+      e->negotiate = true;
+    }
+
+    const Entry* expected = nullptr;
+    if (entry_.compare_exchange_strong(expected, e.get(), std::memory_order_acq_rel))
+      return e.release();
+    return expected;
+  }
+
+  // If-None-Match against `etag` (weak comparison, as RFC 9110 requires for
+  // this header; "*" matches anything).
+  static bool matches(std::string_view ifNoneMatch, std::string_view etag) {
+    while (!ifNoneMatch.empty()) {
+      auto comma = ifNoneMatch.find(',');
+      auto tag = ifNoneMatch.substr(0, comma);
+      ifNoneMatch = comma == std::string_view::npos ? std::string_view() : ifNoneMatch.substr(comma + 1);
+      while (!tag.empty() && tag.front() == ' ') tag.remove_prefix(1);
+      while (!tag.empty() && tag.back() == ' ') tag.remove_suffix(1);
+      if (tag.substr(0, 2) == "W/") tag.remove_prefix(2);
+      if (tag == "*" || tag == etag) return true;
+    }
+    return false;
+  }
+
+ private:
+  static Variant encoded(Encoding enc, const folly::IOBuf& flat, int level,
+                         const std::string& base, const char* suffix) {
+    auto out = compressBody(enc, flat, level);
+    // Keep the variant only when it saves something.
+    if (!out || out->computeChainDataLength() >= flat.length()) return {};
+    out->coalesce();
+    return {std::move(out), quote(base, suffix)};
+  }
+
+  // 64-bit FNV-1a of the body.
+  static std::string hash(const folly::IOBuf& flat) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < flat.length(); i++) { h ^= flat.data()[i]; h *= 1099511628211ull; }
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+    return buf;
+  }
+  static std::string quote(const std::string& base, const char* suffix) {
+    return "\"" + base + suffix + "\"";
+  }
+
+  std::atomic<const Entry*> entry_{nullptr};
+};
@@ -1,21 +1,65 @@
 #pragma once
-#include <string>
-#include <unordered_map>
+#include <proxygen/lib/http/HTTPMessage.h>
 #include <chrono>
+#include <cstdio>
+#include <random>
+#include <string_view>
 
+#include "RouteTable.h"
+
+// Per-request view over the proxygen HTTPMessage. Nothing is copied up
+// front: headers are resolved on demand through proxygen's case-insensitive
+// lookup, params are string_views into the request path, and the request id
+// lives in an inline buffer. The context is embedded in the request handler
+// (see RouterHandler), so it shares that one per-request allocation and must
+// not outlive the message it was built from.
 struct RouteContext {
-  std::string method;
-  std::string path;
-  std::unordered_map<std::string,std::string> params;
-  std::unordered_map<std::string,std::string> reqHeaders;
-  std::string requestId;
+  explicit RouteContext(const proxygen::HTTPMessage& m)
+      : msg(&m), method(m.getMethodString()), methodId(methodFromString(method)),
+        path(trimPath(m.getPath())), start(std::chrono::steady_clock::now()) {
+    static thread_local std::mt19937_64 rng{std::random_device{}()};
+    uint64_t a=rng(), b=rng();
+    snprintf(idBuf_, sizeof(idBuf_), "%016llx%016llx",
+             (unsigned long long)a, (unsigned long long)b);
+    requestId = std::string_view(idBuf_, 32);
+  }
+  RouteContext(const RouteContext&) = delete;
+  RouteContext& operator=(const RouteContext&) = delete;
+
+  const proxygen::HTTPMessage* msg;
+  std::string_view method;
+  Method methodId;
+  std::string_view path;
+  int32_t routeId = -1;  // dense id of the matched route, -1 if none
+  RouteParams params;
+  std::string_view requestId;
   std::chrono::steady_clock::time_point start;
 
-  const std::string& param(const std::string& k, const std::string& d="") const {
-    auto it = params.find(k); return it==params.end()? d : it->second;
+  std::string_view param(std::string_view k, std::string_view d = {}) const {
+    return params.get(k, d);
+  }
+  std::string_view header(std::string_view k, std::string_view d = {}) const {
+    auto& v = msg->getHeaders().getSingleOrEmpty(folly::StringPiece(k));
+    return v.empty() ? d : std::string_view(v);
   }
-  std::string header(std::string k, const std::string& d="") const {
-    for (auto& c: k) c = char(::tolower(c));
-    auto it = reqHeaders.find(k); return it==reqHeaders.end()? d : it->second;
+  std::string_view header(proxygen::HTTPHeaderCode code, std::string_view d = {}) const {
+    auto& v = msg->getHeaders().getSingleOrEmpty(code);
+    return v.empty() ? d : std::string_view(v);
   }
+  // Decoded query-string parameter (parsed by proxygen on first use).
+  std::string_view query(const std::string& k, std::string_view d = {}) const {
+    auto& v = msg->getQueryParam(k);
+    return v.empty() ? d : std::string_view(v);
+  }
+
+  // Request path as routes are matched against it: no query, no trailing '/'.
+  static std::string_view trimPath(std::string_view p) {
+    auto q = p.find('?');
+    if (q != std::string_view::npos) p = p.substr(0, q);
+    if (p.size() > 1 && p.back() == '/') p.remove_suffix(1);
+    return p;
+  }
+
+ private:
+  char idBuf_[33];
 };
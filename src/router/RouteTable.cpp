@@ -0,0 +1,183 @@
+#include "RouteTable.h"
+#include "PathPattern.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// ============================================================================
+// Methods
+// ============================================================================
+
+Method methodFromString(std::string_view m) {
+  switch (m.size()) {
+    case 3: if (m=="GET") return Method::Get; if (m=="PUT") return Method::Put; break;
+    case 4: if (m=="HEAD") return Method::Head; if (m=="POST") return Method::Post; break;
+    case 5: if (m=="PATCH") return Method::Patch; break;
+    case 6: if (m=="DELETE") return Method::Delete; break;
+    case 7: if (m=="OPTIONS") return Method::Options; break;
+  }
+  return Method::Unknown;
+}
+
+const char* methodName(Method m) {
+  static constexpr const char* names[] = {"GET","HEAD","POST","PUT","DELETE","PATCH","OPTIONS","UNKNOWN"};
+  return names[size_t(m)];
+}
+
+// ============================================================================
+// Registration trie
+// ============================================================================
+
+TrieNode* trieInsert(TrieNode& root, const std::string& path) {
+  TrieNode* node = &root;
+  size_t params = 0;
+  for (auto& seg : splitPath(path)) {
+    if (!seg.empty() && (seg[0]==':' || seg[0]=='*')) {
+      if (++params > RouteParams::kMax)
+        throw std::invalid_argument("too many params in route: " + path);
+    }
+    if (!seg.empty() && seg[0]==':') {
+      if (!node->paramChild) node->paramChild = std::make_unique<TrieNode>();
+      node = node->paramChild.get();
+      node->paramName = seg.substr(1);
+    } else if (!seg.empty() && seg[0]=='*') {
+      if (!node->wildcardChild) node->wildcardChild = std::make_unique<TrieNode>();
+      node = node->wildcardChild.get();
+      node->paramName = seg.substr(1);
+      break; // wildcard consumes rest
+    } else {
+      auto& child = node->children[seg];
+      if (!child) child = std::make_unique<TrieNode>();
+      node = child.get();
+    }
+  }
+  return node;
+}
+
+TrieNode* trieFind(TrieNode& root, const std::string& path) {
+  TrieNode* node = &root;
+  for (auto& seg : splitPath(path)) {
+    if (!seg.empty() && seg[0]==':') {
+      if (!node->paramChild || node->paramChild->paramName != seg.substr(1)) return nullptr;
+      node = node->paramChild.get();
+    } else if (!seg.empty() && seg[0]=='*') {
+      if (!node->wildcardChild || node->wildcardChild->paramName != seg.substr(1)) return nullptr;
+      return node->wildcardChild.get();
+    } else {
+      auto it = node->children.find(seg);
+      if (it == node->children.end()) return nullptr;
+      node = it->second.get();
+    }
+  }
+  return node;
+}
+
+// ============================================================================
+// RouteTable
+// ============================================================================
+
+void RouteTable::build(const TrieRoots& roots) {
+  nodes_.clear(); edges_.clear(); pool_.clear(); patterns_.clear();
+  for (size_t m=0; m<kMethodCount; m++)
+    roots_[m] = roots[m] ? flatten(*roots[m]) : kNone;
+}
+
+uint32_t RouteTable::flatten(const TrieNode& n) {
+  const uint32_t idx = uint32_t(nodes_.size());
+  nodes_.emplace_back();
+  {
+    Node& out = nodes_[idx];
+    out.route = n.route;
+    out.nameOff = uint32_t(pool_.size());
+    out.nameLen = uint32_t(n.paramName.size());
+    pool_ += n.paramName;
+  }
+  if (n.route >= 0) {
+    if (patterns_.size() <= size_t(n.route)) patterns_.resize(n.route+1);
+    patterns_[n.route] = n.pattern;
+  }
+
+  std::vector<const std::pair<const std::string, std::unique_ptr<TrieNode>>*> kids;
+  kids.reserve(n.children.size());
+  for (auto& kv : n.children) kids.push_back(&kv);
+  std::sort(kids.begin(), kids.end(), [](auto* a, auto* b){ return a->first < b->first; });
+
+  // Reserve this node's edge range up front so it stays contiguous while
+  // children append their own edges below.
+  const uint32_t begin = uint32_t(edges_.size());
+  for (auto* kv : kids) {
+    edges_.push_back({uint32_t(pool_.size()), uint32_t(kv->first.size()), kNone});
+    pool_ += kv->first;
+  }
+  nodes_[idx].edgeBegin = begin;
+  nodes_[idx].edgeEnd = uint32_t(edges_.size());
+
+  for (size_t i=0; i<kids.size(); i++) {
+    const uint32_t child = flatten(*kids[i]->second);
+    edges_[begin+i].child = child;
+  }
+  if (n.paramChild) { const uint32_t c = flatten(*n.paramChild); nodes_[idx].param = c; }
+  if (n.wildcardChild) { const uint32_t c = flatten(*n.wildcardChild); nodes_[idx].wildcard = c; }
+  return idx;
+}
+
+uint32_t RouteTable::findEdge(const Node& n, std::string_view seg) const {
+  uint32_t lo = n.edgeBegin, hi = n.edgeEnd;
+  if (hi - lo <= 8) {
+    for (; lo<hi; lo++) if (str(edges_[lo].off, edges_[lo].len) == seg) return edges_[lo].child;
+    return kNone;
+  }
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi-lo)/2;
+    const int c = str(edges_[mid].off, edges_[mid].len).compare(seg);
+    if (c == 0) return edges_[mid].child;
+    if (c < 0) lo = mid+1; else hi = mid;
+  }
+  return kNone;
+}
+
+bool RouteTable::matchFrom(uint32_t idx, std::string_view path, size_t pos,
+                           RouteParams& params, int32_t& out) const {
+  const Node& node = nodes_[idx];
+  while (pos<path.size() && path[pos]=='/') ++pos;
+  if (pos >= path.size()) {
+    if (node.route >= 0) { out = node.route; return true; }
+    return false;
+  }
+  size_t end = path.find('/', pos);
+  if (end == std::string_view::npos) end = path.size();
+  const std::string_view seg = path.substr(pos, end-pos);
+
+  // literal match
+  if (node.edgeBegin != node.edgeEnd) {
+    const uint32_t child = findEdge(node, seg);
+    if (child != kNone && matchFrom(child, path, end, params, out)) return true;
+  }
+  // param match
+  if (node.param != kNone) {
+    const Node& p = nodes_[node.param];
+    params.push(str(p.nameOff, p.nameLen), seg);
+    if (matchFrom(node.param, path, end, params, out)) return true;
+    params.pop();
+  }
+  // wildcard consumes the rest of the path
+  if (node.wildcard != kNone) {
+    const Node& w = nodes_[node.wildcard];
+    if (w.route < 0) return false;
+    params.push(str(w.nameOff, w.nameLen), path.substr(pos));
+    out = w.route;
+    return true;
+  }
+  return false;
+}
+
+int32_t RouteTable::match(Method m, std::string_view path, RouteParams& params) const {
+  params.clear();
+  if (m == Method::Unknown || roots_[size_t(m)] == kNone) return -1;
+  const size_t q = path.find('?');
+  if (q != std::string_view::npos) path = path.substr(0, q);
+  if (path.size() > 1 && path.back() == '/') path.remove_suffix(1);
+
+  int32_t out = -1;
+  return matchFrom(roots_[size_t(m)], path, 0, params, out) ? out : -1;
+}
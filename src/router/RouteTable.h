@@ -0,0 +1,105 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// ----------------------------
+// Interned HTTP methods
+// ----------------------------
+enum class Method : uint8_t { Get, Head, Post, Put, Delete, Patch, Options, Unknown };
+constexpr size_t kMethodCount = size_t(Method::Unknown);
+
+Method methodFromString(std::string_view m);
+const char* methodName(Method m);
+
+// ----------------------------
+// Captured params
+// ----------------------------
+// Names point into the frozen table, values into the request path, so a match
+// never allocates. Routes with more than kMax params are rejected on insert.
+struct RouteParams {
+  static constexpr size_t kMax = 8;
+  struct Entry { std::string_view name, value; };
+
+  std::array<Entry, kMax> items{};
+  uint8_t count = 0;
+
+  std::string_view get(std::string_view k, std::string_view d = {}) const {
+    for (uint8_t i = 0; i < count; i++) if (items[i].name == k) return items[i].value;
+    return d;
+  }
+  void push(std::string_view k, std::string_view v) { items[count++] = {k, v}; }
+  void pop() { --count; }
+  void clear() { count = 0; }
+};
+
+// ----------------------------
+// Registration trie
+// ----------------------------
+// Mutable and allocation-heavy; only touched while registering routes.
+// `route` is a dense id (index into the owner's route list), -1 when not
+// terminal; `pattern` is the registered template, e.g. "GET /users/:id".
+struct TrieNode {
+  std::unordered_map<std::string, std::unique_ptr<TrieNode>> children;
+  std::unique_ptr<TrieNode> paramChild;
+  std::unique_ptr<TrieNode> wildcardChild;
+  std::string paramName;
+  int32_t route = -1;
+  std::string pattern;
+};
+
+using TrieRoots = std::array<std::unique_ptr<TrieNode>, kMethodCount>;
+
+// Inserts `path` under `root` and returns the terminal node.
+TrieNode* trieInsert(TrieNode& root, const std::string& path);
+// Node registered for exactly this template, or nullptr.
+TrieNode* trieFind(TrieNode& root, const std::string& path);
+
+// ----------------------------
+// Frozen matcher
+// ----------------------------
+// Flattened copy of the trie: nodes and literal edges live in two contiguous
+// vectors, edges of a node are sorted so lookups can binary search, and
+// every string lives in one pool. match() scans the raw path with
+// string_views and does no heap allocation.
+class RouteTable {
+ public:
+  void build(const TrieRoots& roots);
+
+  // Returns the route index or -1. `path` may carry a query string.
+  int32_t match(Method m, std::string_view path, RouteParams& params) const;
+
+  size_t nodeCount() const { return nodes_.size(); }
+  // Route templates indexed by route id.
+  const std::vector<std::string>& patterns() const { return patterns_; }
+
+ private:
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  struct Edge {
+    uint32_t off, len;  // literal segment in pool_
+    uint32_t child;
+  };
+  struct Node {
+    uint32_t edgeBegin = 0, edgeEnd = 0;
+    uint32_t param = kNone, wildcard = kNone;
+    uint32_t nameOff = 0, nameLen = 0;  // param/wildcard name in pool_
+    int32_t route = -1;
+  };
+
+  uint32_t flatten(const TrieNode& n);
+  std::string_view str(uint32_t off, uint32_t len) const { return {pool_.data() + off, len}; }
+  uint32_t findEdge(const Node& n, std::string_view seg) const;
+  bool matchFrom(uint32_t node, std::string_view path, size_t pos,
+                 RouteParams& params, int32_t& out) const;
+
+  std::vector<Node> nodes_;
+  std::vector<Edge> edges_;
+  std::string pool_;
+  std::vector<std::string> patterns_;
+  std::array<uint32_t, kMethodCount> roots_{};
+};
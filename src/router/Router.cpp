@@ -1,5 +1,4 @@
 #include "Router.h"
-#include "PathPattern.h"
 #include "Response.h"
 #include "Middleware.h"
 #include "Metrics.h"
@@ -8,67 +7,551 @@
 #include <proxygen/httpserver/RequestHandler.h>
 #include <proxygen/httpserver/RequestHandlerFactory.h>
 #include <folly/io/async/EventBase.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <folly/io/IOBufQueue.h>
+#include <algorithm>
+#include <charconv>
 #include <chrono>
-#include <random>
-#include <numeric>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <new>
+#include <optional>
+#include <set>
+
+// ============================================================================
+// Built-in middlewares
+// ============================================================================
+
+namespace {
+
+bool corsBefore(RouteContext& ctx, Res& res) {
+  if (ctx.methodId==Method::Options &&
+      !ctx.header(proxygen::HTTP_HEADER_ACCESS_CONTROL_REQUEST_METHOD).empty()) {
+    res.status(204,"No Content");
+    res.header(proxygen::HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN,"*");
+    res.header(proxygen::HTTP_HEADER_ACCESS_CONTROL_ALLOW_METHODS,"GET,POST,PUT,PATCH,DELETE,OPTIONS");
+    res.header(proxygen::HTTP_HEADER_ACCESS_CONTROL_ALLOW_HEADERS,"Content-Type,Authorization,X-Requested-With");
+    return true;
+  }
+  return false;
+}
+
+void corsAfter(Res& res) {
+  res.header(proxygen::HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN,"*");
+}
+
+// Adds `token` to the response's Vary list, keeping what the handler set.
+void addVary(Res& res, std::string_view token) {
+  const std::string_view cur = res.header(proxygen::HTTP_HEADER_VARY);
+  if (cur.empty()) { res.header(proxygen::HTTP_HEADER_VARY, std::string(token)); return; }
+  for (size_t pos = 0; pos < cur.size();) {
+    size_t end = cur.find(',', pos);
+    if (end == std::string_view::npos) end = cur.size();
+    std::string_view item = cur.substr(pos, end - pos);
+    while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+    while (!item.empty() && item.back() == ' ') item.remove_suffix(1);
+    if (item == "*" || (item.size() == token.size() &&
+        std::equal(item.begin(), item.end(), token.begin(),
+                   [](char a, char b){ return ::tolower((unsigned char)a) == ::tolower((unsigned char)b); })))
+      return;
+    pos = end + 1;
+  }
+  std::string v(cur);
+  v += ", ";
+  v += token;
+  res.header(proxygen::HTTP_HEADER_VARY, std::move(v));
+}
+
+void compressAfter(const CompressionOptions& opts, const RouteContext& ctx, Res& res) {
+  if (!res.bodyBuf() || res.keepsEncoding() || res.hasHeader(proxygen::HTTP_HEADER_CONTENT_ENCODING) ||
+      res.bodyLength() < opts.minBytes) return;
+  auto ct = res.header(proxygen::HTTP_HEADER_CONTENT_TYPE);
+  if (ct.empty() || !isCompressible(ct, opts)) return;
+
+  addVary(res, "accept-encoding");
+  const Encoding enc = negotiateEncoding(ctx.header(proxygen::HTTP_HEADER_ACCEPT_ENCODING));
+  if (enc == Encoding::Identity) return;
+
+  auto out = compressBody(enc, *res.bodyBuf(), compressionLevel(enc, opts));
+  if (!out) return;
+  res.header(proxygen::HTTP_HEADER_CONTENT_ENCODING, encodingName(enc));
+  res.body(std::move(out));
+}
+
+bool requestIdBefore(Metrics* m, RouteContext& ctx, Res& res) {
+  if (!ctx.requestId.empty()) res.header("x-request-id", std::string(ctx.requestId));
+  if (m) m->enter();
+  return false;
+}
+
+void accessLogAfter(AccessLog& log, const RouteContext& ctx, Res& res,
+                    std::chrono::steady_clock::duration elapsed) {
+  AccessRecord r;
+  r.timeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  r.bytes = res.bodyLength();
+  r.latencyUs = uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+  r.routeId = ctx.routeId;
+  r.status = res.code();
+  r.method = uint8_t(ctx.methodId);
+  r.setRequestId(ctx.requestId);
+  const folly::SocketAddress& peer = ctx.msg->getClientAddress();
+  const sa_family_t family = peer.getFamily();
+  if (family == AF_INET || family == AF_INET6) {
+    sockaddr_storage ss;
+    peer.getAddress(&ss);
+    r.peerFamily = uint8_t(family);
+    r.peerPort = peer.getPort();
+    if (family == AF_INET) std::memcpy(r.peerAddr, &reinterpret_cast<sockaddr_in&>(ss).sin_addr, 4);
+    else std::memcpy(r.peerAddr, &reinterpret_cast<sockaddr_in6&>(ss).sin6_addr, 16);
+  }
+  log.log(r);
+}
+
+void requestIdAfter(const Middleware& mw, const RouteContext& ctx, Res& res) {
+  auto end = std::chrono::steady_clock::now();
+  if (mw.accessLog) accessLogAfter(*mw.accessLog, ctx, res, end-ctx.start);
+  double ms = std::chrono::duration<double,std::milli>(end-ctx.start).count();
+  if (Metrics* m = mw.metrics) {
+    m->record(ctx.routeId, ms, res.code()>=500);
+    m->leave();
+  }
+}
+
+bool runBefore(const Middleware& mw, RouteContext& ctx, Res& res) {
+  switch (mw.kind) {
+    case Middleware::Kind::Cors:        return corsBefore(ctx, res);
+    case Middleware::Kind::RequestId:   return requestIdBefore(mw.metrics, ctx, res);
+    case Middleware::Kind::Compression: return false;
+    case Middleware::Kind::Custom:      break;
+  }
+  return mw.before(ctx, res);
+}
+
+void runAfter(const Middleware& mw, const RouteContext& ctx, Res& res) {
+  switch (mw.kind) {
+    case Middleware::Kind::Cors:        corsAfter(res); return;
+    case Middleware::Kind::Compression: compressAfter(*mw.compression, ctx, res); return;
+    case Middleware::Kind::RequestId:   requestIdAfter(mw, ctx, res); return;
+    case Middleware::Kind::Custom:      break;
+  }
+  mw.after(ctx, res);
+}
+
+// Options of the compression middleware in a chain, if there is one.
+const CompressionOptions* compressionFor(const MiddlewareChain& chain) {
+  for (auto* mw : chain.after)
+    if (mw->kind == Middleware::Kind::Compression) return mw->compression;
+  return nullptr;
+}
+
+bool inScope(std::string_view path, std::string_view scope) {
+  if (scope.empty() || scope == "/") return true;
+  return path.size() >= scope.size() && path.compare(0, scope.size(), scope) == 0 &&
+         (path.size() == scope.size() || path[scope.size()] == '/');
+}
+
+} // namespace
 
 // Forward declare RouterHandler if not split
 class RouterHandler : public proxygen::RequestHandler {
  public:
-  RouterHandler(RouterFactory::HandlerFnWithBody fn,
-                std::vector<Middleware> mws,
-                RouteContext ctx)
-      : fnBody_(std::move(fn)), middlewares_(std::move(mws)), ctx_(std::move(ctx)) {}
-
-  RouterHandler(RouterFactory::HandlerFnNoBody fn,
-                std::vector<Middleware> mws,
-                RouteContext ctx)
-      : fnNoBody_(std::move(fn)), middlewares_(std::move(mws)), ctx_(std::move(ctx)) {}
-
-  void onRequest(std::unique_ptr<proxygen::HTTPMessage>) noexcept override {}
+  using Route = RouterFactory::Route;
+  using BodyMode = RouterFactory::BodyMode;
+  using SnapshotRef = Published<RouterFactory::Snapshot>::Ref;
+
+  explicit RouterHandler(const proxygen::HTTPMessage& msg) : ctx_(msg) {}
+  // Requests that end without a response of ours (errors, aborts) still
+  // give back their admission slot, but their latency is not sampled.
+  ~RouterHandler() override { release(false); }
+
+  // `snap` keeps the route and chain alive for the life of the request;
+  // `limiter`: admission slot already taken for this request, if any.
+  void bind(SnapshotRef snap, const Route* r, const MiddlewareChain* chain,
+            ConcurrencyLimiter* limiter = nullptr) {
+    snap_ = std::move(snap); route_ = r; chain_ = chain; limiter_ = limiter;
+  }
+  RouteContext& context() { return ctx_; }
+
+  // Keeps the message alive: ctx_ points into its path and headers.
+  void onRequest(std::unique_ptr<proxygen::HTTPMessage> msg) noexcept override {
+    msg_ = std::move(msg);
+    if (route_->maxBodyBytes && declaredLength() > route_->maxBodyBytes) {
+      reject();
+      return;
+    }
+    if (route_->mode == BodyMode::Stream) {
+      reader_ = route_->fnStream(ctx_);
+      if (reader_) reader_->downstream_ = downstream_;
+    }
+  }
 
   void onBody(std::unique_ptr<folly::IOBuf> b) noexcept override {
-    if (b) body_.append(reinterpret_cast<const char*>(b->data()), b->length());
+    if (rejected_ || !b) return;
+    received_ += b->computeChainDataLength();
+    if (route_->maxBodyBytes && received_ > route_->maxBodyBytes) {
+      reject();
+      return;
+    }
+    switch (route_->mode) {
+      case BodyMode::Stream:   if (reader_) reader_->onChunk(std::move(b)); break;
+      case BodyMode::Buffered: body_.append(std::move(b)); break;
+      case BodyMode::None:     break;
+    }
   }
 
   void onEOM() noexcept override {
-    proxygen::ResponseBuilder rb(downstream_);
-    Res res(rb, ctx_);
+    if (rejected_) return;
+    rb_.emplace(downstream_);
+    res_.emplace(*rb_, ctx_);
+    Res& res = *res_;
 
     // before middlewares
-    for (auto& mw : middlewares_) {
-      if (mw.before && mw.before(ctx_, res)) {
-        res.send();
+    for (size_t i = 0; i < chain_->before.size(); i++) {
+      if (runBefore(*chain_->before[i], ctx_, res)) {
+        if (reader_) reader_->onAbort();
+        shortCircuit(i);
         return;
       }
     }
+    res.handlerStarts();
 
-    // handler
-    if (fnBody_)   fnBody_(body_, res);
-    if (fnNoBody_) fnNoBody_(res);
+    // static files
+    if (route_->files) {
+      route_->files->serve(ctx_, ctx_.param(route_->forwardParam), res);
+      finish();
+      return;
+    }
 
-    // after middlewares
-    for (auto& mw : middlewares_) {
-      if (mw.after) mw.after(ctx_, res);
+    // cached response
+    if (route_->cache) {
+      runCached();
+      return;
     }
 
-    res.send();
+    // identical GET already in flight: wait for its result
+    if (route_->flights && ctx_.methodId == Method::Get) {
+      flightKey_ = flightKey();
+      if (auto shared = route_->flights->join(flightKey_)) {
+        flightKey_.clear();
+        await(std::move(*shared).deferValue([this](Singleflight::Result r) { res_->restore(*r); }));
+        return;
+      }
+      leading_ = true;
+    }
+
+    // handler
+    if (route_->pool) {
+      offload(*route_->pool);
+      return;
+    }
+    try {
+      runHandler();
+    } catch (...) {
+      fail(folly::exception_wrapper(std::current_exception()));
+    }
+
+    if (res.deferred()) {
+      await(res.takeDeferred());
+      return;
+    }
+    finish();
   }
 
   void onUpgrade(proxygen::UpgradeProtocol) noexcept override {}
-  void onError(proxygen::ProxygenError) noexcept override { delete this; }
+  void onError(proxygen::ProxygenError) noexcept override {
+    // A deferred or offloaded handler still holds `this` (and may be using
+    // reader_); its continuation cleans up.
+    if (awaiting_) { aborted_ = true; return; }
+    if (reader_) reader_->onAbort();
+    delete this;
+  }
   void requestComplete() noexcept override { delete this; }
 
-  void setParams(std::unordered_map<std::string,std::string> p) {
-    ctx_.params = std::move(p);
+  // Per-request arena. A handler is created and destroyed on its EventBase
+  // thread, so freed blocks go on a thread-local free list and the next
+  // request on that thread reuses one instead of calling malloc.
+  static void* operator new(size_t sz) {
+    auto& fl = freeList();
+    if (sz == sizeof(RouterHandler) && fl.head) {
+      void* p = fl.head;
+      fl.head = fl.head->next; fl.size--;
+      return p;
+    }
+    return ::operator new(sz);
+  }
+  static void operator delete(void* p, size_t sz) {
+    auto& fl = freeList();
+    if (sz == sizeof(RouterHandler) && fl.size < FreeList::kMax) {
+      fl.head = new (p) FreeList::Block{fl.head}; fl.size++;
+      return;
+    }
+    ::operator delete(p);
   }
 
  private:
-  RouterFactory::HandlerFnWithBody fnBody_;
-  RouterFactory::HandlerFnNoBody fnNoBody_;
-  std::vector<Middleware> middlewares_;
+  struct FreeList {
+    static constexpr size_t kMax = 1024;
+    struct Block { Block* next; };
+    Block* head = nullptr;
+    size_t size = 0;
+    ~FreeList() { while (head) { auto* n = head->next; ::operator delete(head); head = n; } }
+  };
+  static FreeList& freeList() { static thread_local FreeList fl; return fl; }
+
+  uint64_t declaredLength() const {
+    auto& v = msg_->getHeaders().getSingleOrEmpty(proxygen::HTTP_HEADER_CONTENT_LENGTH);
+    uint64_t n = 0;
+    std::from_chars(v.data(), v.data() + v.size(), n);
+    return n;
+  }
+
+  void runHandler() {
+    Res& res = *res_;
+    switch (route_->mode) {
+      case BodyMode::None:
+        route_->fnNoBody(res);
+        break;
+      case BodyMode::Buffered: {
+        auto body = body_.move();
+        folly::IOBuf empty;
+        route_->fnBody(body ? *body : empty, res);
+        break;
+      }
+      case BodyMode::Stream:
+        if (reader_) reader_->onEnd(res);
+        else res.status(500,"Internal Server Error").text("no body reader\n", 500);
+        break;
+    }
+  }
+
+  // Serves a cacheable() route from its stored response, filling the store
+  // from the handler on the first request: inline, on the route's worker
+  // pool, or once a deferred response completes (see fillCache).
+  void runCached() {
+    if (const ResponseCache::Entry* e = route_->cache->get()) {
+      serveCached(*e);
+      return;
+    }
+    filling_ = true;
+    if (route_->pool) {
+      offload(*route_->pool);
+      return;
+    }
+    Res& res = *res_;
+    try {
+      runHandler();
+    } catch (...) {
+      fail(folly::exception_wrapper(std::current_exception()));
+    }
+    if (res.deferred()) {
+      await(res.takeDeferred());
+      return;
+    }
+    fillCache();
+  }
+
+  // The handler's response for an empty store. A response that cannot be
+  // cached (not a 200, no body) is sent as is.
+  void fillCache() {
+    filling_ = false;
+    Res& res = *res_;
+    if (res.code() != 200 || !res.bodyBuf()) {
+      finish();
+      return;
+    }
+    serveCached(*route_->cache->store(std::string(res.header(proxygen::HTTP_HEADER_CONTENT_TYPE)),
+                                      *res.bodyBuf(), compressionFor(*chain_)));
+  }
+
+  void serveCached(const ResponseCache::Entry& e) {
+    Res& res = *res_;
+    Encoding enc = Encoding::Identity;
+    if (e.negotiate) {
+      addVary(res, "accept-encoding");
+      enc = negotiateEncoding(ctx_.header(proxygen::HTTP_HEADER_ACCEPT_ENCODING));
+    }
+    const auto& v = e.pick(enc);
+    res.header(proxygen::HTTP_HEADER_ETAG, v.etag);
+    auto inm = ctx_.header(proxygen::HTTP_HEADER_IF_NONE_MATCH);
+    if (!inm.empty() && ResponseCache::matches(inm, v.etag)) {
+      res.status(304, "Not Modified").body(nullptr);
+      finish();
+      return;
+    }
+    // Each variant's bytes are fixed by its ETag: the compression
+    // middleware must not re-encode the identity body either.
+    res.status(200).body(v.body->clone()).keepEncoding();
+    if (!e.contentType.empty()) res.header(proxygen::HTTP_HEADER_CONTENT_TYPE, e.contentType);
+    if (&v != &e.identity) res.header(proxygen::HTTP_HEADER_CONTENT_ENCODING, encodingName(enc));
+    finish();
+  }
+
+  // Runs the handler on a worker pool and resumes here like a deferred
+  // response. A defer() the handler itself makes completes back on this
+  // request's EventBase, as Res::defer promises, not on the worker. The IO
+  // thread leaves res_/body_/reader_ alone until then.
+  void offload(WorkerPool& pool) {
+    folly::Promise<folly::Unit> done;
+    auto f = done.getSemiFuture();
+    folly::EventBase* evb = folly::EventBaseManager::get()->getEventBase();
+    bool queued = pool.add([this, evb, done = std::move(done)]() mutable {
+      try {
+        runHandler();
+      } catch (...) {
+        done.setException(folly::exception_wrapper(std::current_exception()));
+        return;
+      }
+      if (!res_->deferred()) { done.setValue(); return; }
+      res_->takeDeferred().via(evb).thenTry(
+        [done = std::move(done)](folly::Try<folly::Unit>&& t) mutable { done.setTry(std::move(t)); });
+    });
+    if (!queued) {
+      res_->status(503,"Service Unavailable").header(proxygen::HTTP_HEADER_RETRY_AFTER,"1").text("server busy\n", 503);
+      finish();
+      return;
+    }
+    await(std::move(f));
+  }
+
+  // after middlewares, then send
+  void finish() {
+    release(true);
+    publishFlight();
+    for (auto* mw : chain_->after) runAfter(*mw, ctx_, *res_);
+    res_->send();
+  }
+
+  // before[stoppedAt] answered the request itself (a CORS preflight, say).
+  // The handler never ran, but the middleware whose before-step did gets
+  // its after-step, so the RequestId step closes its in-flight count and
+  // records the response.
+  void shortCircuit(size_t stoppedAt) {
+    release(false);
+    const auto ran = chain_->before.begin() + stoppedAt + 1;
+    for (auto* mw : chain_->after)
+      if (std::find(chain_->before.begin(), ran, mw) != ran) runAfter(*mw, ctx_, *res_);
+    res_->send();
+  }
+
+  std::string flightKey() const {
+    std::string key(ctx_.path);
+    key += '?';
+    key += msg_->getQueryString();
+    for (auto& h : route_->flights->vary()) {
+      key += '\0';
+      key += ctx_.header(h);
+    }
+    return key;
+  }
+
+  // Feeds the time spent on the request back into its admission class.
+  void release(bool sample) {
+    if (!limiter_) return;
+    limiter_->release(std::chrono::steady_clock::now() - ctx_.start, sample);
+    limiter_ = nullptr;
+  }
+
+  // Leader of a coalesced GET: hand the handler's result to the followers.
+  void publishFlight() {
+    if (!leading_) return;
+    leading_ = false;
+    route_->flights->done(flightKey_, res_->snapshot());
+  }
+
+  // Resume on this request's EventBase once the deferred work is done.
+  void await(folly::SemiFuture<folly::Unit> work) {
+    awaiting_ = true;
+    std::move(work)
+      .via(folly::EventBaseManager::get()->getEventBase())
+      .thenTry([this](folly::Try<folly::Unit>&& t) {
+        awaiting_ = false;
+        if (t.hasException()) fail(t.exception());
+        if (aborted_) {
+          abandon();
+          return;
+        }
+        if (filling_) fillCache();
+        else finish();
+      });
+  }
+
+  // The client went away while the response was deferred. Nothing is sent,
+  // but followers still get the result and the request is still accounted
+  // for: the RequestId step closes its in-flight count and records it (as
+  // 499) in the metrics and access log.
+  void abandon() {
+    publishFlight();
+    res_->status(499, "Client Closed Request");
+    for (auto* mw : chain_->after)
+      if (mw->kind == Middleware::Kind::RequestId) runAfter(*mw, ctx_, *res_);
+    delete this;
+  }
+
+  void fail(const folly::exception_wrapper& ew) {
+    if (ew.is_compatible_with<folly::FutureTimeout>() || ew.is_compatible_with<WorkerPoolFull>())
+      res_->status(503,"Service Unavailable").text("service unavailable\n", 503);
+    else
+      res_->status(500,"Internal Server Error").text("internal error\n", 500);
+  }
+
+  // 413 and drop whatever else the client sends.
+  void reject() {
+    rejected_ = true;
+    if (reader_) { reader_->onAbort(); reader_.reset(); }
+    body_.move();
+    proxygen::ResponseBuilder(downstream_)
+      .status(413, "Payload Too Large")
+      .header("connection", "close")
+      .body("payload too large\n")
+      .sendWithEOM();
+  }
+
+  SnapshotRef snap_;
+  const Route* route_ = nullptr;
+  const MiddlewareChain* chain_ = nullptr;
+  ConcurrencyLimiter* limiter_ = nullptr;
+  std::unique_ptr<proxygen::HTTPMessage> msg_;
   RouteContext ctx_;
-  std::string body_;
+  folly::IOBufQueue body_{folly::IOBufQueue::cacheChainLength()};
+  std::unique_ptr<BodyReader> reader_;
+  std::optional<proxygen::ResponseBuilder> rb_;
+  std::optional<Res> res_;
+  uint64_t received_ = 0;
+  bool rejected_ = false;
+  bool awaiting_ = false;  // deferred work in flight
+  bool leading_ = false;   // runs the handler for a coalesced GET
+  bool filling_ = false;   // handler output goes into the route's ResponseCache
+  std::string flightKey_;
+  bool aborted_ = false;   // connection went away while awaiting
+};
+
+// Answer for a request turned away by admission control: status and
+// Retry-After go out as soon as the headers arrive, the body is ignored.
+// Deliberately tiny, so shedding stays cheap when the server is overloaded.
+class ShedHandler : public proxygen::RequestHandler {
+ public:
+  ShedHandler(uint16_t code, const char* msg, uint32_t retryAfter)
+    : code_(code), msg_(msg), retryAfter_(retryAfter) {}
+
+  void onRequest(std::unique_ptr<proxygen::HTTPMessage>) noexcept override {
+    proxygen::ResponseBuilder(downstream_)
+      .status(code_, msg_)
+      .header(proxygen::HTTP_HEADER_RETRY_AFTER, std::to_string(retryAfter_))
+      .body(code_ == 429 ? "too many requests\n" : "server busy\n")
+      .sendWithEOM();
+  }
+  void onBody(std::unique_ptr<folly::IOBuf>) noexcept override {}
+  void onEOM() noexcept override {}
+  void onUpgrade(proxygen::UpgradeProtocol) noexcept override {}
+  void requestComplete() noexcept override { delete this; }
+  void onError(proxygen::ProxygenError) noexcept override { delete this; }
+
+ private:
+  uint16_t code_;
+  const char* msg_;
+  uint32_t retryAfter_;
 };
 
 // ============================================================================
@@ -76,220 +559,360 @@ class RouterHandler : public proxygen::RequestHandler {
 // ============================================================================
 
 RouterFactory::RouterFactory() : metrics_(nullptr) {}
-void RouterFactory::onServerStart(folly::EventBase*) noexcept {}
+
+void RouterFactory::onServerStart(folly::EventBase*) noexcept {
+  // Called once per worker thread; the first one compiles the table.
+  std::call_once(frozen_, [this]{ freeze(); });
+}
 void RouterFactory::onServerStop() noexcept {}
 
+void RouterFactory::freeze() {
+  std::lock_guard<std::mutex> lk(writeMu_);
+  startPools();
+  startAdmission();
+  for (auto& r : routes_) if (r.flights) r.flights->bindMetrics(metrics_);
+
+  auto snap = std::make_shared<Snapshot>();
+  snap->table.build(methodRoots_);
+  snap->routes = routes_;
+  snap->ipLimiter = ipLimiter_.get();
+  snap->retryAfter = admissionOpts_.retryAfterSeconds;
+  // Routes removed since the last freeze are still in the last snapshot;
+  // routes removed before any freeze never were in one.
+  snap->retired = std::make_shared<RetiredIds>();
+  snap->retired->freeIds = freeIds_;
+  if (retired_) {
+    retired_->ids = std::move(removedIds_);
+    retired_->next = snap->retired;
+  } else {
+    std::lock_guard<std::mutex> fl(freeIds_->mu);
+    freeIds_->ids.insert(freeIds_->ids.end(), removedIds_.begin(), removedIds_.end());
+  }
+  removedIds_.clear();
+  retired_ = snap->retired;
+  compileChains(*snap);
+  if (metrics_) metrics_->setRoutes(snap->table.patterns());
+  snapshot_.publish(std::move(snap));
+}
+
+// Resolves each route's middleware once. Routes covered by the same set of
+// scopes share one chain.
+void RouterFactory::compileChains(Snapshot& snap) const {
+  std::map<std::vector<size_t>, const MiddlewareChain*> byScopes;
+  auto chainFor = [&](std::string_view path) {
+    std::vector<size_t> key;
+    for (size_t i=0; i<middlewares_.size(); i++)
+      if (!middlewares_[i].removed && inScope(path, middlewares_[i].scope)) key.push_back(i);
+    auto& slot = byScopes[key];
+    if (!slot) {
+      auto c = std::make_unique<MiddlewareChain>();
+      for (size_t i : key) {
+        const Middleware& mw = middlewares_[i].mw;
+        if (mw.hasBefore()) c->before.push_back(&mw);
+        if (mw.hasAfter()) c->after.push_back(&mw);
+      }
+      // The request-id step observes the whole response: it starts the
+      // clock first and records last, after compression has run.
+      auto isRequestId = [](const Middleware* mw) { return mw->kind == Middleware::Kind::RequestId; };
+      std::stable_partition(c->before.begin(), c->before.end(), isRequestId);
+      std::stable_partition(c->after.begin(), c->after.end(), std::not_fn(isRequestId));
+      slot = c.get();
+      snap.chains.push_back(std::move(c));
+    }
+    return slot;
+  };
+
+  for (auto& r : snap.routes) r.chain = chainFor(r.path);
+
+  std::set<std::string> scopes{""};
+  for (auto& m : middlewares_) if (!m.removed) scopes.insert(m.scope);
+  for (auto& sc : scopes) snap.scopeChains.emplace_back(sc, chainFor(sc));
+  std::sort(snap.scopeChains.begin(), snap.scopeChains.end(),
+            [](auto& a, auto& b){ return a.first.size() > b.first.size(); });
+}
+
+void RouterFactory::startPools() {
+  for (auto& r : routes_) {
+    if (r.exec == Exec::Inline) { r.pool = nullptr; continue; }
+    auto& pool = r.exec == Exec::Cpu ? cpuPool_ : blockingPool_;
+    if (!pool) {
+      const bool cpu = r.exec == Exec::Cpu;
+      pool = std::make_unique<WorkerPool>(cpu ? "cpu" : "blocking",
+        cpu ? poolOpts_.cpuThreads : poolOpts_.blockingThreads, poolOpts_.maxQueue, metrics_);
+    }
+    r.pool = pool.get();
+  }
+}
+
+// One limiter per admission class, kept across freeze() calls so in-flight
+// counts and learned limits survive re-freezing.
+void RouterFactory::startAdmission() {
+  if (!admissionOpts_.enabled) return;
+  if (admissionOpts_.ipRate > 0 && !ipLimiter_)
+    ipLimiter_ = std::make_unique<IpRateLimiter>(admissionOpts_, metrics_);
+  for (auto& r : routes_) {
+    if (r.admissionClass.empty()) { r.limiter = nullptr; continue; }
+    auto& l = limiters_[r.admissionClass];
+    if (!l) l = std::make_unique<ConcurrencyLimiter>(r.admissionClass, admissionOpts_, metrics_);
+    r.limiter = l.get();
+  }
+}
+
+const MiddlewareChain* RouterFactory::Snapshot::unmatchedChain(std::string_view path) const {
+  for (auto& [scope, chain] : scopeChains)
+    if (inScope(path, scope)) return chain;
+  return scopeChains.back().second;
+}
+
+RouterFactory::RetiredIds::~RetiredIds() {
+  {
+    std::lock_guard<std::mutex> lk(freeIds->mu);
+    freeIds->ids.insert(freeIds->ids.end(), ids.begin(), ids.end());
+  }
+  // Unlink the rest of the chain here rather than recursively: a request
+  // pinning an old snapshot may be holding a long one.
+  while (next && next.use_count() == 1) next = std::move(next->next);
+}
+
 // Insert a route into the Trie
-void RouterFactory::insert(const std::string& method,
-                           const std::string& path,
-                           bool wantsBody,
-                           HandlerFnNoBody fnNoBody,
-                           HandlerFnWithBody fnWithBody) {
-  if (!methodRoots_.count(method)) {
-    methodRoots_[method] = std::make_unique<TrieNode>();
-  }
-  TrieNode* node = methodRoots_[method].get();
-
-  auto parts = splitPath(path);
-  for (size_t i=0; i<parts.size(); i++) {
-    auto& seg = parts[i];
-    if (!seg.empty() && seg[0]==':') {
-      if (!node->paramChild) node->paramChild = std::make_unique<TrieNode>();
-      node = node->paramChild.get();
-      node->paramName = seg.substr(1);
-    } else if (!seg.empty() && seg[0]=='*') {
-      if (!node->wildcardChild) node->wildcardChild = std::make_unique<TrieNode>();
-      node = node->wildcardChild.get();
-      node->paramName = seg.substr(1);
-      break; // wildcard consumes rest
+RouterFactory::RouteHandle RouterFactory::insert(Method method, const std::string& path, Route r) {
+  std::lock_guard<std::mutex> lk(writeMu_);
+  auto& root = methodRoots_[size_t(method)];
+  if (!root) root = std::make_unique<TrieNode>();
+
+  TrieNode* node = trieInsert(*root, path);
+  if (node->route < 0) {
+    std::lock_guard<std::mutex> fl(freeIds_->mu);
+    if (!freeIds_->ids.empty()) {
+      node->route = freeIds_->ids.back();
+      freeIds_->ids.pop_back();
     } else {
-      if (!node->children.count(seg))
-        node->children[seg] = std::make_unique<TrieNode>();
-      node = node->children[seg].get();
+      node->route = int32_t(routes_.size());
+      routes_.emplace_back();
     }
+    node->pattern = std::string(methodName(method)) + " " + path;
   }
-  node->wantsBody = wantsBody;
-  node->fnNoBody = std::move(fnNoBody);
-  node->fnBody = std::move(fnWithBody);
-}
-
-// Match against Trie
-bool RouterFactory::match(TrieNode* node,
-                          const std::vector<std::string>& parts,
-                          size_t i,
-                          std::unordered_map<std::string,std::string>& params,
-                          TrieNode*& out) {
-  if (i == parts.size()) {
-    if (node->fnNoBody || node->fnBody) { out = node; return true; }
-    return false;
-  }
-  auto& seg = parts[i];
-
-  // literal match
-  if (node->children.count(seg)) {
-    if (match(node->children[seg].get(), parts, i+1, params, out)) return true;
-  }
-  // param match
-  if (node->paramChild) {
-    params[node->paramChild->paramName] = seg;
-    if (match(node->paramChild.get(), parts, i+1, params, out)) return true;
-    params.erase(node->paramChild->paramName);
-  }
-  // wildcard
-  if (node->wildcardChild) {
-    params[node->wildcardChild->paramName] =
-      std::accumulate(parts.begin()+i, parts.end(), std::string(),
-        [](auto& acc,const auto& s){ return acc.empty()?s:acc+"/"+s; });
-    out = node->wildcardChild.get();
-    return true;
-  }
-  return false;
+  r.path = path;
+  routes_[node->route] = std::move(r);
+  return RouteHandle(this, node->route);
+}
+
+// The route's id is reused once the RetiredIds it is handed to go away, so
+// no request still records metrics under it by then (Metrics starts the
+// id's stats over when it shows up with a new template).
+bool RouterFactory::remove(Method method, const std::string& path) {
+  std::lock_guard<std::mutex> lk(writeMu_);
+  auto& root = methodRoots_[size_t(method)];
+  TrieNode* node = root ? trieFind(*root, path) : nullptr;
+  if (!node || node->route < 0) return false;
+  Route dead;
+  dead.admissionClass.clear();
+  routes_[node->route] = std::move(dead);
+  removedIds_.push_back(node->route);
+  node->route = -1;
+  node->pattern.clear();
+  return true;
+}
+
+RouterFactory::RouteHandle& RouterFactory::RouteHandle::maxBody(size_t bytes) {
+  std::lock_guard<std::mutex> lk(parent_->writeMu_);
+  parent_->routes_[id_].maxBodyBytes = bytes;
+  return *this;
+}
+
+RouterFactory::RouteHandle& RouterFactory::RouteHandle::cacheable() {
+  std::lock_guard<std::mutex> lk(parent_->writeMu_);
+  auto& r = parent_->routes_[id_];
+  if (!r.cache) r.cache = std::make_shared<ResponseCache>();
+  return *this;
 }
 
-// Handle new requests
+RouterFactory::RouteHandle& RouterFactory::RouteHandle::coalesce(std::vector<std::string> varyHeaders) {
+  std::lock_guard<std::mutex> lk(parent_->writeMu_);
+  parent_->routes_[id_].flights = std::make_shared<Singleflight>(std::move(varyHeaders));
+  return *this;
+}
+
+RouterFactory::RouteHandle& RouterFactory::RouteHandle::admissionClass(std::string name) {
+  std::lock_guard<std::mutex> lk(parent_->writeMu_);
+  parent_->routes_[id_].admissionClass = std::move(name);
+  return *this;
+}
+
+RouterFactory::RouteHandle& RouterFactory::RouteHandle::exec(Exec e) {
+  std::lock_guard<std::mutex> lk(parent_->writeMu_);
+  parent_->routes_[id_].exec = e;
+  return *this;
+}
+
+// Handle new requests. Routing and admission only look at the message, so
+// a shed request never gets a RouterHandler.
 proxygen::RequestHandler* RouterFactory::onRequest(
     proxygen::RequestHandler*, proxygen::HTTPMessage* msg) noexcept {
+  auto snap = snapshot_.pin();
+  const uint32_t retryAfter = snap->retryAfter;
+  if (snap->ipLimiter && !snap->ipLimiter->allow(msg->getClientIP()))
+    return new ShedHandler(429, "Too Many Requests", retryAfter);
+
+  RouteParams params;
+  const int32_t route = snap->table.match(methodFromString(msg->getMethodString()),
+                                          RouteContext::trimPath(msg->getPath()), params);
+  const Route* r = route >= 0 ? &snap->routes[route] : nullptr;
+  ConcurrencyLimiter* limiter = r ? r->limiter : nullptr;
+  if (limiter && !limiter->acquire())
+    return new ShedHandler(503, "Service Unavailable", retryAfter);
+
+  if (r && r->upstreams) {
+    std::string_view forward = msg->getPath();
+    if (!r->forwardParam.empty()) forward = params.get(r->forwardParam);
+    else forward = forward.substr(0, forward.find('?'));
+    return newProxyHandler(r->upstreams, forward, limiter, route, snap->retired);
+  }
 
-  RouteContext ctx;
-  ctx.method = msg->getMethodString();
-  ctx.path   = stripQuery(msg->getPath());
-  ctx.start  = std::chrono::steady_clock::now();
-  ctx.requestId = [] {
-    static thread_local std::mt19937_64 rng{std::random_device{}()};
-    uint64_t a=rng(), b=rng();
-    char buf[33]; snprintf(buf,sizeof(buf),"%016llx%016llx",
-                           (unsigned long long)a,(unsigned long long)b);
-    return std::string(buf);
-  }();
-
-  // headers
-  msg->getHeaders().forEach([&](const std::string& name, const std::string& value) {
-    std::string k = name;
-    for (auto& c: k) c = char(::tolower(c));
-    ctx.reqHeaders[k] = value;
-  });
-
-  const auto parts = splitPath(ctx.path);
-
-  auto it = methodRoots_.find(ctx.method);
-  if (it != methodRoots_.end()) {
-    TrieNode* matched=nullptr;
-    std::unordered_map<std::string,std::string> params;
-    if (match(it->second.get(), parts, 0, params, matched)) {
-      auto h = matched->wantsBody
-        ? new RouterHandler(matched->fnBody, middlewares_, ctx)
-        : new RouterHandler(matched->fnNoBody, middlewares_, ctx);
-      h->setParams(std::move(params));
-      return h;
-    }
+  auto* h = new RouterHandler(*msg);
+  RouteContext& ctx = h->context();
+  ctx.params = params;
+  ctx.routeId = route;
+  if (r) {
+    h->bind(std::move(snap), r, r->chain, limiter);
+    return h;
   }
 
   // fallback 404
-  return new RouterHandler(
-    [](Res& res){ res.status(404,"Not Found").text("no route\n"); },
-    middlewares_,
-    ctx
-  );
+  static const Route notFound = [] {
+    Route r;
+    r.fnNoBody = [](Res& res){ res.status(404,"Not Found").text("no route\n"); };
+    return r;
+  }();
+  const MiddlewareChain* chain = snap->unmatchedChain(ctx.path);
+  h->bind(std::move(snap), &notFound, chain);
+  return h;
 }
 
 // ============================================================================
 // Route registration wrappers
 // ============================================================================
 
-void RouterFactory::get(const std::string& path, HandlerFnNoBody fn) {
-  insert("GET", path, false, std::move(fn), {});
+RouterFactory::RouteHandle RouterFactory::get(const std::string& path, HandlerFnNoBody fn) {
+  Route r; r.fnNoBody = std::move(fn);
+  return insert(Method::Get, path, std::move(r));
+}
+RouterFactory::RouteHandle RouterFactory::head(const std::string& path, HandlerFnNoBody fn) {
+  Route r; r.fnNoBody = std::move(fn);
+  return insert(Method::Head, path, std::move(r));
+}
+RouterFactory::RouteHandle RouterFactory::post(const std::string& path, HandlerFnNoBody fn) {
+  Route r; r.fnNoBody = std::move(fn);
+  return insert(Method::Post, path, std::move(r));
 }
-void RouterFactory::head(const std::string& path, HandlerFnNoBody fn) {
-  insert("HEAD", path, false, std::move(fn), {});
+RouterFactory::RouteHandle RouterFactory::post(const std::string& path, HandlerFnWithBody fn) {
+  Route r; r.mode = BodyMode::Buffered; r.fnBody = std::move(fn);
+  return insert(Method::Post, path, std::move(r));
 }
-void RouterFactory::post(const std::string& path, HandlerFnNoBody fn) {
-  insert("POST", path, false, std::move(fn), {});
+RouterFactory::RouteHandle RouterFactory::put(const std::string& path, HandlerFnNoBody fn) {
+  Route r; r.fnNoBody = std::move(fn);
+  return insert(Method::Put, path, std::move(r));
 }
-void RouterFactory::post(const std::string& path, HandlerFnWithBody fn) {
-  insert("POST", path, true, {}, std::move(fn));
+RouterFactory::RouteHandle RouterFactory::put(const std::string& path, HandlerFnWithBody fn) {
+  Route r; r.mode = BodyMode::Buffered; r.fnBody = std::move(fn);
+  return insert(Method::Put, path, std::move(r));
 }
-void RouterFactory::put(const std::string& path, HandlerFnNoBody fn) {
-  insert("PUT", path, false, std::move(fn), {});
+RouterFactory::RouteHandle RouterFactory::del(const std::string& path, HandlerFnNoBody fn) {
+  Route r; r.fnNoBody = std::move(fn);
+  return insert(Method::Delete, path, std::move(r));
 }
-void RouterFactory::put(const std::string& path, HandlerFnWithBody fn) {
-  insert("PUT", path, true, {}, std::move(fn));
+RouterFactory::RouteHandle RouterFactory::patch(const std::string& path, HandlerFnNoBody fn) {
+  Route r; r.fnNoBody = std::move(fn);
+  return insert(Method::Patch, path, std::move(r));
 }
-void RouterFactory::del(const std::string& path, HandlerFnNoBody fn) {
-  insert("DELETE", path, false, std::move(fn), {});
+RouterFactory::RouteHandle RouterFactory::patch(const std::string& path, HandlerFnWithBody fn) {
+  Route r; r.mode = BodyMode::Buffered; r.fnBody = std::move(fn);
+  return insert(Method::Patch, path, std::move(r));
 }
-void RouterFactory::patch(const std::string& path, HandlerFnNoBody fn) {
-  insert("PATCH", path, false, std::move(fn), {});
+RouterFactory::RouteHandle RouterFactory::postStream(const std::string& path, HandlerFnStream fn) {
+  Route r; r.mode = BodyMode::Stream; r.fnStream = std::move(fn);
+  return insert(Method::Post, path, std::move(r));
 }
-void RouterFactory::patch(const std::string& path, HandlerFnWithBody fn) {
-  insert("PATCH", path, true, {}, std::move(fn));
+RouterFactory::RouteHandle RouterFactory::putStream(const std::string& path, HandlerFnStream fn) {
+  Route r; r.mode = BodyMode::Stream; r.fnStream = std::move(fn);
+  return insert(Method::Put, path, std::move(r));
+}
+
+void RouterFactory::proxy(const std::string& path, const std::vector<std::string>& upstreams,
+                          ProxyOptions opts) {
+  Route r;
+  if (opts.stripPrefix) {
+    auto star = path.rfind("/*");
+    if (star != std::string::npos) r.forwardParam = path.substr(star + 2);
+  }
+  r.admissionClass = opts.admissionClass;
+  r.upstreams = std::make_shared<UpstreamGroup>(upstreams, std::move(opts), metrics_);
+  for (Method m : {Method::Get, Method::Head, Method::Post, Method::Put,
+                   Method::Delete, Method::Patch, Method::Options})
+    insert(m, path, r);
+}
+
+void RouterFactory::staticDir(const std::string& prefix, const std::string& root, StaticOptions opts) {
+  std::string mount = prefix;
+  while (mount.size() > 1 && mount.back() == '/') mount.pop_back();
+  Route r;
+  r.files = std::make_shared<StaticFiles>(root, std::move(opts), metrics_);
+  r.forwardParam = "file";
+  for (Method m : {Method::Get, Method::Head}) {
+    insert(m, mount, r);
+    insert(m, (mount == "/" ? "" : mount) + "/*file", r);
+  }
 }
 
 // ============================================================================
 // Middleware registration
 // ============================================================================
 
-void RouterFactory::useBefore(std::function<bool(RouteContext&, Res&)> fn) {
-  middlewares_.push_back({std::move(fn), {}});
+RouterFactory::MiddlewareId RouterFactory::addMiddleware(std::string scope, Middleware mw) {
+  std::lock_guard<std::mutex> lk(writeMu_);
+  if (scope == "/") scope.clear();
+  middlewares_.push_back({std::move(scope), std::move(mw)});
+  return MiddlewareId(middlewares_.size() - 1);
 }
-void RouterFactory::useAfter(std::function<void(const RouteContext&, Res&)> fn) {
-  middlewares_.push_back({{}, std::move(fn)});
+
+// Marked rather than erased: published snapshots still point at it.
+void RouterFactory::removeMiddleware(MiddlewareId id) {
+  std::lock_guard<std::mutex> lk(writeMu_);
+  if (id < middlewares_.size()) middlewares_[id].removed = true;
 }
 
-// ============================================================================
-// Built-in middlewares
-// ============================================================================
+const CompressionOptions* RouterFactory::keep(CompressionOptions opts) {
+  std::lock_guard<std::mutex> lk(writeMu_);
+  compressionOpts_.push_back(std::move(opts));
+  return &compressionOpts_.back();
+}
 
-void RouterFactory::useCORS() {
-  useBefore([](RouteContext& ctx, Res& res)->bool {
-    if (ctx.method=="OPTIONS" && !ctx.header("access-control-request-method").empty()) {
-      res.status(204,"No Content");
-      res.header("access-control-allow-origin","*");
-      res.header("access-control-allow-methods","GET,POST,PUT,PATCH,DELETE,OPTIONS");
-      res.header("access-control-allow-headers","Content-Type,Authorization,X-Requested-With");
-      return true;
-    }
-    return false;
-  });
-  useAfter([](const RouteContext&, Res& res){
-    res.header("access-control-allow-origin","*");
-  });
-}
-
-void RouterFactory::useCompression() {
-  useAfter([](const RouteContext& ctx, Res& res){
-    auto ae = ctx.header("accept-encoding");
-    if (res.body().empty()) return;
-    if (ae.find("br")!=std::string::npos) {
-      std::string out; if (brotliCompress(res.body(), out)) {
-        res.headers()["content-encoding"] = "br";
-        res.body().swap(out);
-        return;
-      }
-    }
-    if (ae.find("gzip")!=std::string::npos) {
-      std::string out; if (gzipCompress(res.body(), out)) {
-        res.headers()["content-encoding"] = "gzip";
-        res.body().swap(out);
-      }
-    }
-  });
+RouterFactory::MiddlewareId RouterFactory::useBefore(std::function<bool(RouteContext&, Res&)> fn) {
+  Middleware mw; mw.before = std::move(fn);
+  return addMiddleware("", std::move(mw));
+}
+RouterFactory::MiddlewareId RouterFactory::useAfter(std::function<void(const RouteContext&, Res&)> fn) {
+  Middleware mw; mw.after = std::move(fn);
+  return addMiddleware("", std::move(mw));
 }
 
-void RouterFactory::useRequestIdLoggingAndMetrics(Metrics* m) {
+RouterFactory::MiddlewareId RouterFactory::useCORS() {
+  Middleware mw; mw.kind = Middleware::Kind::Cors;
+  return addMiddleware("", std::move(mw));
+}
+
+RouterFactory::MiddlewareId RouterFactory::useCompression(CompressionOptions opts) {
+  Middleware mw; mw.kind = Middleware::Kind::Compression;
+  mw.compression = keep(std::move(opts));
+  return addMiddleware("", std::move(mw));
+}
+
+RouterFactory::MiddlewareId RouterFactory::useRequestIdLoggingAndMetrics(Metrics* m, AccessLog* log) {
   metrics_ = m;
-  useBefore([this](RouteContext& ctx, Res& res){
-    if (!ctx.requestId.empty()) res.header("x-request-id", ctx.requestId);
-    if (metrics_) metrics_->in_flight++;
-    return false;
-  });
-  useAfter([this](const RouteContext& ctx, Res& res){
-    auto end = std::chrono::steady_clock::now();
-    double ms = std::chrono::duration<double,std::milli>(end-ctx.start).count();
-    if (metrics_) {
-      metrics_->record(ctx.method+":"+ctx.path, ms, res.code()>=500);
-      metrics_->in_flight--;
-    }
-  });
+  Middleware mw; mw.kind = Middleware::Kind::RequestId;
+  mw.metrics = m;
+  mw.accessLog = log;
+  return addMiddleware("", std::move(mw));
 }
 
 // ============================================================================
@@ -300,35 +923,75 @@ RouterFactory::Group::Group(RouterFactory* parent, std::string prefix)
     : parent_(parent), prefix_(normalize(std::move(prefix))) {}
 
 RouterFactory::Group RouterFactory::Group::group(const std::string& child) const {
-  return Group(parent_, join(child));
+  Group g(parent_, join(child));
+  g.exec_ = exec_;
+  return g;
+}
+
+RouterFactory::RouteHandle RouterFactory::Group::apply(RouteHandle h) const {
+  if (exec_ != Exec::Inline) h.exec(exec_);
+  return h;
 }
 
-void RouterFactory::Group::get(const std::string& p, HandlerFnNoBody fn) {
-  parent_->get(join(p), std::move(fn));
+RouterFactory::RouteHandle RouterFactory::Group::get(const std::string& p, HandlerFnNoBody fn) {
+  return apply(parent_->get(join(p), std::move(fn)));
+}
+RouterFactory::RouteHandle RouterFactory::Group::head(const std::string& p, HandlerFnNoBody fn) {
+  return apply(parent_->head(join(p), std::move(fn)));
+}
+RouterFactory::RouteHandle RouterFactory::Group::post(const std::string& p, HandlerFnNoBody fn) {
+  return apply(parent_->post(join(p), std::move(fn)));
+}
+RouterFactory::RouteHandle RouterFactory::Group::post(const std::string& p, HandlerFnWithBody fn) {
+  return apply(parent_->post(join(p), std::move(fn)));
+}
+RouterFactory::RouteHandle RouterFactory::Group::put(const std::string& p, HandlerFnNoBody fn) {
+  return apply(parent_->put(join(p), std::move(fn)));
+}
+RouterFactory::RouteHandle RouterFactory::Group::put(const std::string& p, HandlerFnWithBody fn) {
+  return apply(parent_->put(join(p), std::move(fn)));
 }
-void RouterFactory::Group::head(const std::string& p, HandlerFnNoBody fn) {
-  parent_->head(join(p), std::move(fn));
+RouterFactory::RouteHandle RouterFactory::Group::del(const std::string& p, HandlerFnNoBody fn) {
+  return apply(parent_->del(join(p), std::move(fn)));
 }
-void RouterFactory::Group::post(const std::string& p, HandlerFnNoBody fn) {
-  parent_->post(join(p), std::move(fn));
+RouterFactory::RouteHandle RouterFactory::Group::patch(const std::string& p, HandlerFnNoBody fn) {
+  return apply(parent_->patch(join(p), std::move(fn)));
 }
-void RouterFactory::Group::post(const std::string& p, HandlerFnWithBody fn) {
-  parent_->post(join(p), std::move(fn));
+RouterFactory::RouteHandle RouterFactory::Group::patch(const std::string& p, HandlerFnWithBody fn) {
+  return apply(parent_->patch(join(p), std::move(fn)));
 }
-void RouterFactory::Group::put(const std::string& p, HandlerFnNoBody fn) {
-  parent_->put(join(p), std::move(fn));
+RouterFactory::RouteHandle RouterFactory::Group::postStream(const std::string& p, HandlerFnStream fn) {
+  return apply(parent_->postStream(join(p), std::move(fn)));
 }
-void RouterFactory::Group::put(const std::string& p, HandlerFnWithBody fn) {
-  parent_->put(join(p), std::move(fn));
+RouterFactory::RouteHandle RouterFactory::Group::putStream(const std::string& p, HandlerFnStream fn) {
+  return apply(parent_->putStream(join(p), std::move(fn)));
+}
+
+void RouterFactory::Group::proxy(const std::string& p, const std::vector<std::string>& upstreams,
+                                 ProxyOptions opts) {
+  parent_->proxy(join(p), upstreams, std::move(opts));
+}
+
+void RouterFactory::Group::staticDir(const std::string& p, const std::string& root, StaticOptions opts) {
+  parent_->staticDir(join(p), root, std::move(opts));
+}
+
+RouterFactory::MiddlewareId RouterFactory::Group::useBefore(std::function<bool(RouteContext&, Res&)> fn) {
+  Middleware mw; mw.before = std::move(fn);
+  return parent_->addMiddleware(prefix_, std::move(mw));
 }
-void RouterFactory::Group::del(const std::string& p, HandlerFnNoBody fn) {
-  parent_->del(join(p), std::move(fn));
+RouterFactory::MiddlewareId RouterFactory::Group::useAfter(std::function<void(const RouteContext&, Res&)> fn) {
+  Middleware mw; mw.after = std::move(fn);
+  return parent_->addMiddleware(prefix_, std::move(mw));
 }
-void RouterFactory::Group::patch(const std::string& p, HandlerFnNoBody fn) {
-  parent_->patch(join(p), std::move(fn));
+RouterFactory::MiddlewareId RouterFactory::Group::useCORS() {
+  Middleware mw; mw.kind = Middleware::Kind::Cors;
+  return parent_->addMiddleware(prefix_, std::move(mw));
 }
-void RouterFactory::Group::patch(const std::string& p, HandlerFnWithBody fn) {
-  parent_->patch(join(p), std::move(fn));
+RouterFactory::MiddlewareId RouterFactory::Group::useCompression(CompressionOptions opts) {
+  Middleware mw; mw.kind = Middleware::Kind::Compression;
+  mw.compression = parent_->keep(std::move(opts));
+  return parent_->addMiddleware(prefix_, std::move(mw));
 }
 
 // Helpers
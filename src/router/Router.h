@@ -2,23 +2,44 @@
 
 #include "RouteContext.h"
 #include "Response.h"
+#include "BodyReader.h"
 #include "Middleware.h"
 #include "Metrics.h"
+#include "RouteTable.h"
+#include "Compression.h"
+#include "JsonBind.h"
+#include "ResponseCache.h"
+#include "Singleflight.h"
+#include "WorkerPool.h"
+#include "Admission.h"
+#include "Published.h"
+#include "Proxy.h"
+#include "StaticFiles.h"
+#include "AccessLog.h"
 
 #include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 class RouterFactory : public proxygen::RequestHandlerFactory {
  public:
-  using HandlerFnWithBody = std::function<void(const std::string&, Res&)>;
+  // Buffered body handlers get the whole body as an IOBuf chain; call
+  // coalesce() only if the consumer needs contiguous bytes.
+  using HandlerFnWithBody = std::function<void(folly::IOBuf&, Res&)>;
   using HandlerFnNoBody   = std::function<void(Res&)>;
+  // Streaming handlers return a reader that sees the body as it arrives.
+  using HandlerFnStream   = std::function<std::unique_ptr<BodyReader>(const RouteContext&)>;
 
   RouterFactory();
 
+  // Handle for a registered middleware, for removeMiddleware().
+  using MiddlewareId = uint32_t;
+
   // Proxygen interface
   void onServerStart(folly::EventBase*) noexcept override;
   void onServerStop() noexcept override;
@@ -26,18 +47,93 @@ class RouterFactory : public proxygen::RequestHandlerFactory {
       proxygen::RequestHandler*,
       proxygen::HTTPMessage* msg) noexcept override;
 
+  // ----------------------------
+  // Per-route options
+  // ----------------------------
+  // Where a route's handler runs. Inline is the IO thread; Cpu and Blocking
+  // are bounded worker pools (see WorkerPoolOptions). Middleware always runs
+  // on the IO thread.
+  enum class Exec : uint8_t { Inline, Cpu, Blocking };
+
+  // Returned by the registration verbs: router->post(...).maxBody(1 << 20);
+  class RouteHandle {
+   public:
+    // Reject bodies larger than `bytes` with 413: up front when the
+    // Content-Length says so, otherwise as soon as the limit is crossed.
+    RouteHandle& maxBody(size_t bytes);
+    // Run the handler on the CPU pool (parsing, hashing, rendering).
+    RouteHandle& cpu() { return exec(Exec::Cpu); }
+    // Run the handler on the blocking pool (synchronous I/O).
+    RouteHandle& blocking() { return exec(Exec::Blocking); }
+    RouteHandle& exec(Exec e);
+    // The response never changes: the first 200 the handler produces is
+    // stored (content-type and body, plus br/gzip variants if the route is
+    // under useCompression) with strong ETags, and later requests are served
+    // from it, or answered 304 on If-None-Match, without calling the
+    // handler. Before/after middleware still run; the fill runs wherever
+    // exec() puts the handler, deferred responses included.
+    RouteHandle& cacheable();
+    // GET only: identical requests (same path, query and `varyHeaders`)
+    // arriving while one is being handled wait for it and share its result
+    // instead of running the handler again.
+    RouteHandle& coalesce(std::vector<std::string> varyHeaders = {"authorization", "cookie"});
+    // Admission class whose concurrency limit this route counts against
+    // (see admission()); "default" unless set, "" exempts the route.
+    RouteHandle& admissionClass(std::string name);
+
+   private:
+    friend class RouterFactory;
+    RouteHandle(RouterFactory* parent, int32_t id) : parent_(parent), id_(id) {}
+    RouterFactory* parent_;
+    int32_t id_;
+  };
+
   // ----------------------------
   // Route registration (verbs)
   // ----------------------------
-  void get   (const std::string& path, HandlerFnNoBody fn);
-  void head  (const std::string& path, HandlerFnNoBody fn);
-  void post  (const std::string& path, HandlerFnNoBody fn);
-  void post  (const std::string& path, HandlerFnWithBody fn);
-  void put   (const std::string& path, HandlerFnNoBody fn);
-  void put   (const std::string& path, HandlerFnWithBody fn);
-  void del   (const std::string& path, HandlerFnNoBody fn);
-  void patch (const std::string& path, HandlerFnNoBody fn);
-  void patch (const std::string& path, HandlerFnWithBody fn);
+  RouteHandle get   (const std::string& path, HandlerFnNoBody fn);
+  RouteHandle head  (const std::string& path, HandlerFnNoBody fn);
+  RouteHandle post  (const std::string& path, HandlerFnNoBody fn);
+  RouteHandle post  (const std::string& path, HandlerFnWithBody fn);
+  RouteHandle put   (const std::string& path, HandlerFnNoBody fn);
+  RouteHandle put   (const std::string& path, HandlerFnWithBody fn);
+  RouteHandle del   (const std::string& path, HandlerFnNoBody fn);
+  RouteHandle patch (const std::string& path, HandlerFnNoBody fn);
+  RouteHandle patch (const std::string& path, HandlerFnWithBody fn);
+
+  RouteHandle postStream (const std::string& path, HandlerFnStream fn);
+  RouteHandle putStream  (const std::string& path, HandlerFnStream fn);
+
+  // Reverse proxy: every method on `path` is forwarded to one of
+  // `upstreams` ("host:port") over keep-alive connections pooled per
+  // EventBase, with both bodies streamed through. Upstreams are picked by
+  // power of two choices on outstanding requests and ejected for a while
+  // after repeated failures (see ProxyOptions). Proxy routes skip the
+  // Res-based middleware; they are still admission-controlled and counted
+  // in the per-route metrics (register them after
+  // useRequestIdLoggingAndMetrics for the upstream counters too).
+  //   router->proxy("/svc/*rest", {"10.0.0.1:8080", "10.0.0.2:8080"});
+  void proxy(const std::string& path, const std::vector<std::string>& upstreams, ProxyOptions opts = {});
+
+  // GET/HEAD for the files under directory `root`, mounted at `prefix`
+  // (see StaticFiles: mmap'd LRU, ranges, ETags, .br/.gz siblings). The
+  // mount point itself serves opts.index. Middleware runs as for any route.
+  //   router->staticDir("/assets", "./public");
+  void staticDir(const std::string& prefix, const std::string& root, StaticOptions opts = {});
+
+  // Unregisters the route registered for exactly this method and template;
+  // false if there is none. Like any change, it takes effect on freeze().
+  // The route's RouteHandle must not be used afterwards: its id goes to
+  // the next route registered once no request can still be routed to it.
+  bool remove(Method method, const std::string& path);
+
+  // Typed JSON bodies: the body is bound into a T (see JsonSchema in
+  // JsonBind.h) before fn runs; bodies that do not bind get a 400.
+  //   router->postJson<Signup>("/signup", [](Signup& s, Res& res){ ... });
+  template <class T> using HandlerFnJson = std::function<void(T&, Res&)>;
+  template <class T> RouteHandle postJson (const std::string& path, HandlerFnJson<T> fn) { return post(path, bindBody(std::move(fn))); }
+  template <class T> RouteHandle putJson  (const std::string& path, HandlerFnJson<T> fn) { return put(path, bindBody(std::move(fn))); }
+  template <class T> RouteHandle patchJson(const std::string& path, HandlerFnJson<T> fn) { return patch(path, bindBody(std::move(fn))); }
 
   // ----------------------------
   // Group support
@@ -48,22 +144,45 @@ class RouterFactory : public proxygen::RequestHandlerFactory {
 
     Group group(const std::string& child) const;
 
-    void get   (const std::string& p, HandlerFnNoBody fn);
-    void head  (const std::string& p, HandlerFnNoBody fn);
-    void post  (const std::string& p, HandlerFnNoBody fn);
-    void post  (const std::string& p, HandlerFnWithBody fn);
-    void put   (const std::string& p, HandlerFnNoBody fn);
-    void put   (const std::string& p, HandlerFnWithBody fn);
-    void del   (const std::string& p, HandlerFnNoBody fn);
-    void patch (const std::string& p, HandlerFnNoBody fn);
-    void patch (const std::string& p, HandlerFnWithBody fn);
+    RouteHandle get   (const std::string& p, HandlerFnNoBody fn);
+    RouteHandle head  (const std::string& p, HandlerFnNoBody fn);
+    RouteHandle post  (const std::string& p, HandlerFnNoBody fn);
+    RouteHandle post  (const std::string& p, HandlerFnWithBody fn);
+    RouteHandle put   (const std::string& p, HandlerFnNoBody fn);
+    RouteHandle put   (const std::string& p, HandlerFnWithBody fn);
+    RouteHandle del   (const std::string& p, HandlerFnNoBody fn);
+    RouteHandle patch (const std::string& p, HandlerFnNoBody fn);
+    RouteHandle patch (const std::string& p, HandlerFnWithBody fn);
+
+    RouteHandle postStream (const std::string& p, HandlerFnStream fn);
+    RouteHandle putStream  (const std::string& p, HandlerFnStream fn);
+
+    void proxy(const std::string& p, const std::vector<std::string>& upstreams, ProxyOptions opts = {});
+    void staticDir(const std::string& p, const std::string& root, StaticOptions opts = {});
+
+    template <class T> RouteHandle postJson (const std::string& p, HandlerFnJson<T> fn) { return apply(parent_->postJson<T>(join(p), std::move(fn))); }
+    template <class T> RouteHandle putJson  (const std::string& p, HandlerFnJson<T> fn) { return apply(parent_->putJson<T>(join(p), std::move(fn))); }
+    template <class T> RouteHandle patchJson(const std::string& p, HandlerFnJson<T> fn) { return apply(parent_->patchJson<T>(join(p), std::move(fn))); }
+
+    // Middleware scoped to routes under this group's prefix.
+    MiddlewareId useBefore(std::function<bool(RouteContext&, Res&)> fn);
+    MiddlewareId useAfter(std::function<void(const RouteContext&, Res&)> fn);
+    MiddlewareId useCORS();
+    MiddlewareId useCompression(CompressionOptions opts = {});
+
+    // Default Exec for routes registered through this group (and groups
+    // created from it) from here on; RouteHandle::exec still overrides it.
+    Group& cpu() { exec_ = Exec::Cpu; return *this; }
+    Group& blocking() { exec_ = Exec::Blocking; return *this; }
 
    private:
     static std::string normalize(std::string s);
     std::string join(const std::string& p) const;
+    RouteHandle apply(RouteHandle h) const;
 
     RouterFactory* parent_;
     std::string prefix_;
+    Exec exec_ = Exec::Inline;
   };
 
   Group group(const std::string& prefix);
@@ -71,42 +190,152 @@ class RouterFactory : public proxygen::RequestHandlerFactory {
   // ----------------------------
   // Middleware system
   // ----------------------------
-  void useBefore(std::function<bool(RouteContext&, Res&)> fn);
-  void useAfter(std::function<void(const RouteContext&, Res&)> fn);
+  // Router-level middleware applies to every route, group-level middleware
+  // (Group::use...) to routes under the group's prefix. Each route's chain is
+  // resolved once on freeze(), in registration order, except that the
+  // request-id step wraps all the others (first before, last after) so its
+  // latency and byte counts cover what they do to the response.
+  MiddlewareId useBefore(std::function<bool(RouteContext&, Res&)> fn);
+  MiddlewareId useAfter(std::function<void(const RouteContext&, Res&)> fn);
 
   // Built-in middlewares
-  void useCORS();
-  void useCompression();
-  void useRequestIdLoggingAndMetrics(Metrics* m);
+  MiddlewareId useCORS();
+  MiddlewareId useCompression(CompressionOptions opts = {});
+  // Request ids, per-route metrics on `m` and, with `log`, one access-log
+  // record per response (see AccessLog; never blocks the request).
+  MiddlewareId useRequestIdLoggingAndMetrics(Metrics* m, AccessLog* log = nullptr);
+
+  // Drops a router- or group-level middleware; takes effect on freeze().
+  void removeMiddleware(MiddlewareId id);
 
   Metrics* metrics() const { return metrics_; }
 
+  // Sizes of the Cpu/Blocking pools; call before the server starts. Pools
+  // are only created if some route uses them.
+  void workerPools(WorkerPoolOptions opts) { poolOpts_ = opts; }
+
+  // Load shedding, checked in onRequest before a handler is allocated:
+  // clients over their per-IP rate get 429, and requests past their route
+  // class's adaptive concurrency limit get 503, both with Retry-After.
+  // Limits, in-flight counts and shed totals are exported as
+  // admission_<class>_* on the router's Metrics. Like route changes, it
+  // takes effect on freeze().
+  void admission(AdmissionOptions opts) {
+    std::lock_guard<std::mutex> lk(writeMu_);
+    admissionOpts_ = opts;
+  }
+
+  // Compiles the registered routes and middleware into an immutable
+  // snapshot (flat matcher, per-route chains) and publishes it to onRequest.
+  // Runs automatically on server start. Routes and middleware may be added,
+  // replaced or removed while the server runs, from any thread; requests
+  // keep using the previous snapshot until freeze() publishes the changes,
+  // and a request in flight finishes on the snapshot it started with.
+  void freeze();
+
  private:
-  // Trie structure for routes
-  struct TrieNode {
-    std::unordered_map<std::string, std::unique_ptr<TrieNode>> children;
-    std::unique_ptr<TrieNode> paramChild;
-    std::unique_ptr<TrieNode> wildcardChild;
+  friend class RouterHandler;
 
+  enum class BodyMode : uint8_t { None, Buffered, Stream };
+
+  struct Route {
+    BodyMode mode = BodyMode::None;
     HandlerFnWithBody fnBody;
     HandlerFnNoBody fnNoBody;
-    bool wantsBody = false;
-    std::string paramName;
+    HandlerFnStream fnStream;
+    size_t maxBodyBytes = 0;  // 0 = unlimited
+    std::string path;
+    Exec exec = Exec::Inline;
+    const MiddlewareChain* chain = nullptr;  // set by freeze()
+    WorkerPool* pool = nullptr;              // set by freeze() unless Inline
+    std::shared_ptr<ResponseCache> cache;    // cacheable() routes
+    std::shared_ptr<Singleflight> flights;   // coalesce() routes
+    std::string admissionClass = "default";
+    ConcurrencyLimiter* limiter = nullptr;   // set by freeze() if admission is on
+    std::shared_ptr<UpstreamGroup> upstreams;  // proxy() routes
+    std::shared_ptr<StaticFiles> files;        // staticDir() routes
+    std::string forwardParam;  // wildcard whose value is forwarded or served, "" = whole path
+  };
+
+  struct ScopedMiddleware {
+    std::string scope;  // path prefix, "" for router-wide
+    Middleware mw;
+    bool removed = false;
+  };
+
+  // Route ids freed by remove(), for insert() to hand out again.
+  struct FreeIds {
+    std::mutex mu;
+    std::vector<int32_t> ids;
+  };
+
+  // Ids of the routes removed after the snapshot holding this was built.
+  // Each one also holds the next snapshot's, so the ids only go back to
+  // the free list once no snapshot that still routes to them is left, nor
+  // a request (proxied ones included) that started on one.
+  struct RetiredIds {
+    std::shared_ptr<FreeIds> freeIds;
+    std::vector<int32_t> ids;
+    std::shared_ptr<RetiredIds> next;
+    ~RetiredIds();
+  };
+
+  // What onRequest routes against. Immutable once published; routes are
+  // copies of routes_ (indexed by route id) and chains point into
+  // middlewares_, whose entries are never erased.
+  struct Snapshot {
+    RouteTable table;
+    std::vector<Route> routes;
+    std::vector<std::unique_ptr<MiddlewareChain>> chains;
+    // Longest scope first; picks the chain for requests that match no route.
+    std::vector<std::pair<std::string, const MiddlewareChain*>> scopeChains;
+    // Admission state onRequest reads: freeze() may create the limiter on
+    // a running server, so it is published here rather than read from
+    // the factory.
+    IpRateLimiter* ipLimiter = nullptr;  // owned by the factory, never freed before it
+    uint32_t retryAfter = 1;
+    std::shared_ptr<RetiredIds> retired;
+
+    const MiddlewareChain* unmatchedChain(std::string_view path) const;
   };
 
-  void insert(const std::string& method,
-              const std::string& path,
-              bool wantsBody,
-              HandlerFnNoBody fnNoBody,
-              HandlerFnWithBody fnWithBody);
+  template <class T>
+  static HandlerFnWithBody bindBody(HandlerFnJson<T> fn) {
+    return [fn = std::move(fn)](folly::IOBuf& body, Res& res) {
+      T value{};
+      std::string error;
+      if (!bindJson(body, value, error)) {
+        res.json({{"error", "bad_request"}, {"detail", error}}, 400);
+        return;
+      }
+      fn(value, res);
+    };
+  }
 
-  bool match(TrieNode* node,
-             const std::vector<std::string>& parts,
-             size_t i,
-             std::unordered_map<std::string,std::string>& params,
-             TrieNode*& out);
+  RouteHandle insert(Method method, const std::string& path, Route r);
+  MiddlewareId addMiddleware(std::string scope, Middleware mw);
+  const CompressionOptions* keep(CompressionOptions opts);
+  void compileChains(Snapshot& snap) const;
+  void startPools();
+  void startAdmission();
 
-  std::unordered_map<std::string, std::unique_ptr<TrieNode>> methodRoots_;
-  std::vector<Middleware> middlewares_;
+  // Registration state, guarded by writeMu_. Only freeze() reads it on
+  // behalf of requests, by building a Snapshot.
+  std::mutex writeMu_;
+  TrieRoots methodRoots_;
+  std::vector<Route> routes_;
+  std::shared_ptr<FreeIds> freeIds_ = std::make_shared<FreeIds>();
+  std::vector<int32_t> removedIds_;      // since the last freeze()
+  std::shared_ptr<RetiredIds> retired_;  // the latest snapshot's
+  std::once_flag frozen_;
+  // deques: snapshots point at these, so they must not move on growth
+  std::deque<ScopedMiddleware> middlewares_;
+  std::deque<CompressionOptions> compressionOpts_;
+  Published<Snapshot> snapshot_;
   Metrics* metrics_;
+  WorkerPoolOptions poolOpts_;
+  std::unique_ptr<WorkerPool> cpuPool_, blockingPool_;
+  AdmissionOptions admissionOpts_;
+  std::unique_ptr<IpRateLimiter> ipLimiter_;
+  std::unordered_map<std::string, std::unique_ptr<ConcurrencyLimiter>> limiters_;  // by class
 };
@@ -0,0 +1,71 @@
+#pragma once
+#include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Metrics.h"
+#include "Response.h"
+
+// In-flight request coalescing for a coalesce() route. The first request
+// for a key (path, query and the route's varying request headers) runs
+// the handler; identical requests that arrive while it is running wait for
+// its result and get the same status, headers and body (shared buffers,
+// cloned per follower). Each request still runs its own middleware.
+class Singleflight {
+ public:
+  using Result = std::shared_ptr<const Res::Snapshot>;
+
+  explicit Singleflight(std::vector<std::string> vary) : vary_(std::move(vary)) {}
+  Singleflight(const Singleflight&) = delete;
+  Singleflight& operator=(const Singleflight&) = delete;
+
+  const std::vector<std::string>& vary() const { return vary_; }
+
+  void bindMetrics(Metrics* m) {
+    if (!m || leaders_) return;  // bound once, before requests can see it
+    leaders_ = &m->counter("http_coalesce_leaders_total");
+    followers_ = &m->counter("http_coalesced_requests_total");
+  }
+
+  // Leader: returns nullopt and the caller must call done(key, ...) once the
+  // handler finishes. Follower: returns the leader's future result.
+  std::optional<folly::SemiFuture<Result>> join(const std::string& key) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = inflight_.find(key);
+    if (it != inflight_.end()) {
+      count(followers_);
+      return it->second->getSemiFuture();
+    }
+    inflight_.emplace(key, std::make_shared<folly::SharedPromise<Result>>());
+    count(leaders_);
+    return std::nullopt;
+  }
+
+  void done(const std::string& key, Result r) {
+    std::shared_ptr<folly::SharedPromise<Result>> p;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      auto it = inflight_.find(key);
+      if (it == inflight_.end()) return;
+      p = std::move(it->second);
+      inflight_.erase(it);
+    }
+    p->setValue(std::move(r));
+  }
+
+ private:
+  static void count(std::atomic<uint64_t>* c) { if (c) c->fetch_add(1, std::memory_order_relaxed); }
+
+  const std::vector<std::string> vary_;
+  std::mutex mu_;
+  std::unordered_map<std::string, std::shared_ptr<folly::SharedPromise<Result>>> inflight_;
+  std::atomic<uint64_t>* leaders_ = nullptr;
+  std::atomic<uint64_t>* followers_ = nullptr;
+};
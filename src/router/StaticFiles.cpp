@@ -0,0 +1,338 @@
+#include "StaticFiles.h"
+#include "Compression.h"
+#include "ResponseCache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <charconv>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <initializer_list>
+#include <unordered_map>
+
+namespace {
+
+int64_t nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void unmap(void* p, void* len) { munmap(p, reinterpret_cast<size_t>(len)); }
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Percent-decodes `raw` into a path relative to the root; false if it is
+// malformed or could leave the root ("..", NUL, a leading '/').
+bool relativePath(std::string_view raw, std::string& out) {
+  out.clear();
+  for (size_t i = 0; i < raw.size(); i++) {
+    char c = raw[i];
+    if (c == '%') {
+      if (i + 2 >= raw.size()) return false;
+      const int hi = hexValue(raw[i+1]), lo = hexValue(raw[i+2]);
+      if (hi < 0 || lo < 0) return false;
+      c = char(hi * 16 + lo);
+      i += 2;
+    }
+    if (c == '\0') return false;
+    out += c;
+  }
+  while (!out.empty() && out.front() == '/') out.erase(0, 1);
+  for (size_t pos = 0; pos <= out.size();) {
+    size_t end = out.find('/', pos);
+    if (end == std::string::npos) end = out.size();
+    const std::string_view seg(out.data() + pos, end - pos);
+    if (seg == "." || seg == "..") return false;
+    pos = end + 1;
+  }
+  return true;
+}
+
+const char* contentType(std::string_view path) {
+  static const std::unordered_map<std::string_view, const char*> types{
+    {"html", "text/html; charset=utf-8"}, {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"}, {"js", "application/javascript"},
+    {"mjs", "application/javascript"}, {"json", "application/json"},
+    {"map", "application/json"}, {"txt", "text/plain; charset=utf-8"},
+    {"xml", "application/xml"}, {"svg", "image/svg+xml"}, {"png", "image/png"},
+    {"jpg", "image/jpeg"}, {"jpeg", "image/jpeg"}, {"gif", "image/gif"},
+    {"webp", "image/webp"}, {"avif", "image/avif"}, {"ico", "image/x-icon"},
+    {"wasm", "application/wasm"}, {"woff", "font/woff"}, {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"}, {"otf", "font/otf"}, {"pdf", "application/pdf"},
+    {"mp4", "video/mp4"}, {"webm", "video/webm"}};
+  const size_t dot = path.rfind('.'), slash = path.rfind('/');
+  if (dot == std::string_view::npos || (slash != std::string_view::npos && dot < slash))
+    return "application/octet-stream";
+  auto it = types.find(path.substr(dot + 1));
+  return it != types.end() ? it->second : "application/octet-stream";
+}
+
+std::string httpDate(int64_t ns) {
+  const time_t t = time_t(ns / 1000000000);
+  tm g;
+  gmtime_r(&t, &g);
+  char buf[32];
+  strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &g);
+  return buf;
+}
+
+// Seconds since the epoch of an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37
+// GMT", the only form we send); false for anything else.
+bool parseHttpDate(std::string_view v, int64_t& secs) {
+  char buf[40];
+  if (v.size() >= sizeof(buf)) return false;
+  std::memcpy(buf, v.data(), v.size());
+  buf[v.size()] = '\0';
+  tm g{};
+  const char* end = strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &g);
+  if (!end || *end) return false;
+  secs = int64_t(timegm(&g));
+  return true;
+}
+
+// Parses a single "bytes=first-last" range (suffix and open-ended forms
+// too) against `size`. Returns 1 for a satisfiable range, 0 for none or an
+// unsupported form (serve the whole file), -1 for unsatisfiable (416).
+int parseRange(std::string_view v, uint64_t size, uint64_t& first, uint64_t& last) {
+  if (v.substr(0, 6) != "bytes=") return 0;
+  v.remove_prefix(6);
+  if (v.find(',') != std::string_view::npos) return 0;  // multipart: whole file instead
+  const size_t dash = v.find('-');
+  if (dash == std::string_view::npos) return 0;
+  auto num = [](std::string_view s, uint64_t& n) {
+    return !s.empty() && std::from_chars(s.data(), s.data() + s.size(), n).ptr == s.data() + s.size();
+  };
+  const std::string_view a = v.substr(0, dash), b = v.substr(dash + 1);
+  uint64_t x = 0, y = 0;
+  if (a.empty()) {  // last y bytes
+    if (!num(b, y)) return 0;
+    if (y == 0 || size == 0) return -1;
+    first = y >= size ? 0 : size - y;
+    last = size - 1;
+    return 1;
+  }
+  if (!num(a, x) || (!b.empty() && !num(b, y)) || (!b.empty() && y < x)) return 0;
+  if (x >= size) return -1;
+  first = x;
+  last = b.empty() || y >= size ? size - 1 : y;
+  return 1;
+}
+
+} // namespace
+
+// ============================================================================
+// StaticFiles
+// ============================================================================
+
+StaticFiles::StaticFiles(std::string root, StaticOptions opts, Metrics* metrics)
+    : root_(std::move(root)), opts_(std::move(opts)) {
+  if (metrics) {
+    hits_ = &metrics->counter("static_cache_hits_total");
+    misses_ = &metrics->counter("static_cache_misses_total");
+    cachedBytes_ = &metrics->gauge("static_cache_bytes");
+  }
+}
+
+StaticFiles::FilePtr StaticFiles::load(const std::string& path, Body body) {
+  auto f = std::make_shared<File>();
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return f;
+  struct stat st;
+  if (fstat(fd, &st) == 0) {
+    f->exists = true;
+    f->dir = S_ISDIR(st.st_mode);
+    f->ino = uint64_t(st.st_ino);
+    f->size = uint64_t(st.st_size);
+    f->mtimeNs = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    if (body == Body::Copy && S_ISREG(st.st_mode)) {
+      // Owned bytes: a later in-place rewrite of the file cannot touch them.
+      auto buf = folly::IOBuf::create(f->size);
+      uint64_t n = 0;
+      for (ssize_t k; n < f->size && (k = pread(fd, buf->writableTail(), f->size - n, off_t(n))) != 0;) {
+        if (k < 0) { if (errno == EINTR) continue; break; }
+        buf->append(size_t(k));
+        n += uint64_t(k);
+      }
+      if (n == f->size) f->data = std::move(buf);
+      else f->exists = false;  // changed under us; the next lookup re-stats
+    } else if (body == Body::Map && S_ISREG(st.st_mode)) {
+      if (f->size == 0) {
+        f->data = folly::IOBuf::create(0);
+      } else if (void* p = mmap(nullptr, f->size, PROT_READ, MAP_PRIVATE, fd, 0); p != MAP_FAILED) {
+        madvise(p, f->size, MADV_SEQUENTIAL);
+        f->data = folly::IOBuf::takeOwnership(p, f->size, unmap, reinterpret_cast<void*>(size_t(f->size)));
+      } else {
+        f->exists = false;
+      }
+    }
+  }
+  close(fd);
+  f->checkedMs.store(nowMs(), std::memory_order_relaxed);
+  return f;
+}
+
+StaticFiles::FilePtr StaticFiles::lookup(const std::string& path) {
+  Shard& sh = shards_[std::hash<std::string>{}(path) % kShards];
+  const int64_t now = nowMs();
+  FilePtr cached;
+  {
+    std::lock_guard<std::mutex> lk(sh.mu);
+    auto it = sh.map.find(path);
+    if (it != sh.map.end()) {
+      cached = it->second.file;
+      sh.lru.splice(sh.lru.begin(), sh.lru, it->second.pos);
+    }
+  }
+  if (cached && now - cached->checkedMs.load(std::memory_order_relaxed) < opts_.revalidate.count()) {
+    if (hits_) hits_->fetch_add(1, std::memory_order_relaxed);
+    return cached;
+  }
+
+  // Missing or due for a re-stat: a cheap stat first, then a fresh copy
+  // only if the file changed.
+  FilePtr fresh = load(path, Body::None);
+  if (cached && cached->sameAs(*fresh)) {
+    cached->checkedMs.store(now, std::memory_order_relaxed);
+    if (hits_) hits_->fetch_add(1, std::memory_order_relaxed);
+    return cached;
+  }
+  if (misses_) misses_->fetch_add(1, std::memory_order_relaxed);
+  if (fresh->exists && !fresh->dir && fresh->size <= opts_.maxCachedFileBytes) fresh = load(path, Body::Copy);
+  insert(sh, path, fresh);
+  return fresh;
+}
+
+void StaticFiles::insert(Shard& sh, const std::string& path, FilePtr f) {
+  const size_t maxBytes = opts_.cacheBytes / kShards, maxEntries = std::max<size_t>(1, opts_.maxEntries / kShards);
+  int64_t delta = 0;
+  std::lock_guard<std::mutex> lk(sh.mu);
+  auto it = sh.map.find(path);
+  if (it != sh.map.end()) {
+    if (it->second.file->data) delta -= int64_t(it->second.file->size);
+    sh.lru.splice(sh.lru.begin(), sh.lru, it->second.pos);
+    it->second.file = std::move(f);
+  } else {
+    sh.lru.push_front(path);
+    it = sh.map.emplace(path, Shard::Slot{std::move(f), sh.lru.begin()}).first;
+  }
+  if (it->second.file->data) delta += int64_t(it->second.file->size);
+  sh.bytes += delta;
+
+  // Evict from the cold end; buffers still being sent stay mapped until
+  // their last clone is released.
+  while (sh.map.size() > 1 && (sh.bytes > maxBytes || sh.map.size() > maxEntries)) {
+    auto victim = sh.map.find(sh.lru.back());
+    if (victim->second.file->data) {
+      sh.bytes -= victim->second.file->size;
+      delta -= int64_t(victim->second.file->size);
+    }
+    sh.map.erase(victim);
+    sh.lru.pop_back();
+  }
+  if (cachedBytes_ && delta) cachedBytes_->fetch_add(delta, std::memory_order_relaxed);
+}
+
+void StaticFiles::serve(const RouteContext& ctx, std::string_view rel, Res& res) {
+  std::string path;
+  if (!relativePath(rel, path)) {
+    res.status(400, "Bad Request").text("bad path\n", 400);
+    return;
+  }
+  path = path.empty() ? root_ + "/" + opts_.index : root_ + "/" + path;
+  FilePtr f = lookup(path);
+  if (f->exists && f->dir) {
+    path += "/" + opts_.index;
+    f = lookup(path);
+  }
+  if (!f->exists || f->dir) {
+    res.status(404, "Not Found").text("not found\n", 404);
+    return;
+  }
+
+  // Precompressed sibling, in the client's order of preference.
+  Encoding enc = Encoding::Identity;
+  std::string sent = path;
+  FilePtr v = f;
+  if (opts_.precompressed) {
+    const std::string_view ae = ctx.header(proxygen::HTTP_HEADER_ACCEPT_ENCODING);
+    const bool gzipFirst = negotiateEncoding(ae) == Encoding::Gzip;
+    bool vary = false;
+    for (Encoding e : gzipFirst ? std::initializer_list<Encoding>{Encoding::Gzip, Encoding::Brotli}
+                                : std::initializer_list<Encoding>{Encoding::Brotli, Encoding::Gzip}) {
+      const std::string sib = path + (e == Encoding::Brotli ? ".br" : ".gz");
+      FilePtr s = lookup(sib);
+      if (!s->exists || s->dir) continue;
+      vary = true;
+      if (enc == Encoding::Identity && acceptsEncoding(ae, e)) { enc = e; v = s; sent = sib; }
+    }
+    if (vary) res.header(proxygen::HTTP_HEADER_VARY, "accept-encoding");
+  }
+  // Too big for the cache: map it for this response only.
+  if (!v->data) v = load(sent, Body::Map);
+  if (!v->exists || !v->data) {
+    res.status(404, "Not Found").text("not found\n", 404);
+    return;
+  }
+
+  char tag[64];
+  snprintf(tag, sizeof(tag), "\"%llx-%llx-%llx%s\"", (unsigned long long)v->ino,
+           (unsigned long long)v->mtimeNs, (unsigned long long)v->size,
+           enc == Encoding::Brotli ? "-br" : enc == Encoding::Gzip ? "-gz" : "");
+  const std::string etag = tag, lastModified = httpDate(f->mtimeNs);
+  res.keepEncoding();
+  res.header(proxygen::HTTP_HEADER_CONTENT_TYPE, contentType(path));
+  res.header(proxygen::HTTP_HEADER_ETAG, etag);
+  res.header(proxygen::HTTP_HEADER_LAST_MODIFIED, lastModified);
+  res.header(proxygen::HTTP_HEADER_ACCEPT_RANGES, "bytes");
+  if (opts_.maxAgeSeconds) res.header(proxygen::HTTP_HEADER_CACHE_CONTROL, "public, max-age=" + std::to_string(opts_.maxAgeSeconds));
+  if (enc != Encoding::Identity) res.header(proxygen::HTTP_HEADER_CONTENT_ENCODING, encodingName(enc));
+
+  // If-Modified-Since only counts without If-None-Match (RFC 9110 13.1.3).
+  const std::string_view inm = ctx.header(proxygen::HTTP_HEADER_IF_NONE_MATCH);
+  const std::string_view ims = ctx.header(proxygen::HTTP_HEADER_IF_MODIFIED_SINCE);
+  int64_t since = 0;
+  if (inm.empty() ? !ims.empty() && parseHttpDate(ims, since) && f->mtimeNs / 1000000000 <= since
+                  : ResponseCache::matches(inm, etag)) {
+    res.status(304, "Not Modified").body(nullptr);
+    return;
+  }
+
+  auto body = v->data->clone();
+  const std::string_view range = ctx.header(proxygen::HTTP_HEADER_RANGE);
+  const std::string_view ifRange = ctx.header(proxygen::HTTP_HEADER_IF_RANGE);
+  uint64_t first = 0, last = 0;
+  const int r = range.empty() || (!ifRange.empty() && ifRange != etag && ifRange != lastModified)
+                  ? 0 : parseRange(range, v->size, first, last);
+  if (r < 0) {
+    res.status(416, "Range Not Satisfiable").body(nullptr);
+    res.header(proxygen::HTTP_HEADER_CONTENT_RANGE, "bytes */" + std::to_string(v->size));
+    return;
+  }
+  if (r > 0) {
+    body->trimStart(size_t(first));
+    body->trimEnd(size_t(v->size - last - 1));
+    res.status(206, "Partial Content");
+    res.header(proxygen::HTTP_HEADER_CONTENT_RANGE,
+               "bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(v->size));
+  } else {
+    res.status(200);
+  }
+
+  if (ctx.methodId == Method::Head) {
+    res.header(proxygen::HTTP_HEADER_CONTENT_LENGTH, std::to_string(body->length()));
+    res.body(nullptr);
+    return;
+  }
+  res.body(std::move(body));
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <folly/io/IOBuf.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "Metrics.h"
+#include "Response.h"
+#include "RouteContext.h"
+
+struct StaticOptions {
+  size_t cacheBytes = 64 << 20;          // file bytes the LRU keeps in memory
+  size_t maxCachedFileBytes = 1 << 20;   // larger files are mapped per request
+  size_t maxEntries = 16384;             // cached lookups, misses included
+  std::chrono::milliseconds revalidate{1000};  // re-stat a path at most this often
+  bool precompressed = true;             // serve .br/.gz siblings when accepted
+  std::string index = "index.html";      // for the mount point and directories
+  uint32_t maxAgeSeconds = 0;            // Cache-Control max-age, 0 = header omitted
+};
+
+// Files under `root` for staticDir() routes. Small files are read once into
+// a sharded LRU bounded by cacheBytes and sent as clones of that buffer;
+// the cache owns its bytes, so rewriting a file in place (a plain `cp` over
+// an asset) cannot fault a response. Larger files are mmap'd for the one
+// response and unmapped once proxygen has written it (paced by flow control
+// like any other body): deploy those by writing a new file and rename()ing
+// it over the old one, since truncating a mapped file in place raises
+// SIGBUS. Lookups, hits and misses alike, are cached for `revalidate`, so a
+// hot file costs no syscalls at all.
+//
+// Responses carry strong ETags from inode, mtime and size, Last-Modified,
+// and Accept-Ranges; If-None-Match (or, without it, If-Modified-Since) gets
+// a 304 and a single byte range (honouring If-Range) a 206 or 416. With
+// `precompressed`, "x.br"/"x.gz" next to "x" are sent instead of it when
+// Accept-Encoding allows; bodies are marked keepEncoding() so the
+// compression middleware never touches them.
+class StaticFiles {
+ public:
+  StaticFiles(std::string root, StaticOptions opts, Metrics* metrics = nullptr);
+  StaticFiles(const StaticFiles&) = delete;
+  StaticFiles& operator=(const StaticFiles&) = delete;
+
+  // Answers a GET or HEAD for `rel`, the still percent-encoded path below
+  // the mount point.
+  void serve(const RouteContext& ctx, std::string_view rel, Res& res);
+
+ private:
+  struct File {
+    bool exists = false, dir = false;
+    uint64_t ino = 0, size = 0;
+    int64_t mtimeNs = 0;
+    std::unique_ptr<folly::IOBuf> data;  // contents: owned if cached, else a mapping
+    mutable std::atomic<int64_t> checkedMs{0};
+
+    bool sameAs(const File& o) const {
+      return exists == o.exists && dir == o.dir && ino == o.ino && size == o.size && mtimeNs == o.mtimeNs;
+    }
+  };
+  using FilePtr = std::shared_ptr<const File>;
+
+  struct alignas(64) Shard {
+    std::mutex mu;
+    std::list<std::string> lru;  // front = most recent
+    struct Slot { FilePtr file; std::list<std::string>::iterator pos; };
+    std::unordered_map<std::string, Slot> map;
+    size_t bytes = 0;
+  };
+  static constexpr size_t kShards = 8;
+
+  FilePtr lookup(const std::string& path);
+  void insert(Shard& sh, const std::string& path, FilePtr f);
+  // Stats `path` and, for a regular file, fills in `data` per `body`.
+  enum class Body { None, Copy, Map };
+  static FilePtr load(const std::string& path, Body body);
+
+  const std::string root_;
+  const StaticOptions opts_;
+  Shard shards_[kShards];
+  std::atomic<uint64_t>* hits_ = nullptr;
+  std::atomic<uint64_t>* misses_ = nullptr;
+  std::atomic<int64_t>* cachedBytes_ = nullptr;
+};
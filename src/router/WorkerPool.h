@@ -0,0 +1,90 @@
+#pragma once
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/executors/thread_factory/NamedThreadFactory.h>
+#include <folly/Function.h>
+#include <folly/futures/Future.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include "Metrics.h"
+
+struct WorkerPoolOptions {
+  size_t cpuThreads = 0;        // 0 = one per core
+  size_t blockingThreads = 64;  // mostly parked on I/O, so more than cores
+  size_t maxQueue = 1024;       // per pool; beyond this requests get 503
+};
+
+// Thrown (through the returned future) by WorkerPool::submit when the
+// queue is full; the router answers it with 503.
+struct WorkerPoolFull : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+// Bounded executor for route handlers taken off the IO threads (see
+// RouteHandle::cpu/blocking) and CPU-heavy services. add() refuses work
+// once `maxQueue` tasks are waiting instead of letting the backlog grow.
+// Reports <name>_pool_queue_depth, <name>_pool_queue_wait_seconds and
+// <name>_pool_rejected_total.
+class WorkerPool {
+ public:
+  WorkerPool(const std::string& name, size_t threads, size_t maxQueue, Metrics* metrics)
+      : maxQueue_(maxQueue),
+        executor_(std::make_unique<folly::CPUThreadPoolExecutor>(
+            threads ? threads : std::max(1u, std::thread::hardware_concurrency()),
+            std::make_shared<folly::NamedThreadFactory>(name + "Pool"))) {
+    if (metrics) {
+      depthGauge_ = &metrics->gauge(name + "_pool_queue_depth");
+      wait_ = &metrics->histogram(name + "_pool_queue_wait_seconds");
+      rejected_ = &metrics->counter(name + "_pool_rejected_total");
+    }
+  }
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // False (and `fn` dropped) if the queue is full.
+  bool add(folly::Function<void()> fn) {
+    if (depth_.fetch_add(1, std::memory_order_relaxed) >= int64_t(maxQueue_)) {
+      depth_.fetch_sub(1, std::memory_order_relaxed);
+      if (rejected_) rejected_->fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (depthGauge_) depthGauge_->fetch_add(1, std::memory_order_relaxed);
+    executor_->add([this, fn = std::move(fn), queued = std::chrono::steady_clock::now()]() mutable {
+      depth_.fetch_sub(1, std::memory_order_relaxed);
+      if (depthGauge_) depthGauge_->fetch_sub(1, std::memory_order_relaxed);
+      if (wait_) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - queued).count();
+        wait_->record(uint64_t(us));
+      }
+      fn();
+    });
+    return true;
+  }
+
+  // fn() on the pool as a SemiFuture; fails with WorkerPoolFull if the
+  // queue is full.
+  template <class F>
+  folly::SemiFuture<std::invoke_result_t<F>> submit(F fn) {
+    using T = std::invoke_result_t<F>;
+    folly::Promise<T> p;
+    auto f = p.getSemiFuture();
+    if (!add([p = std::move(p), fn = std::move(fn)]() mutable { p.setWith(std::move(fn)); }))
+      return folly::makeSemiFuture<T>(WorkerPoolFull("worker pool queue full"));
+    return f;
+  }
+
+ private:
+  const size_t maxQueue_;
+  std::atomic<int64_t> depth_{0};
+  std::atomic<int64_t>* depthGauge_ = nullptr;
+  LatencyHistogram* wait_ = nullptr;
+  std::atomic<uint64_t>* rejected_ = nullptr;
+  std::unique_ptr<folly::CPUThreadPoolExecutor> executor_;  // last: joined first
+};
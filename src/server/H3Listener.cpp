@@ -0,0 +1,123 @@
+#include "H3Listener.h"
+
+#include <fizz/protocol/CertUtils.h>
+#include <fizz/server/CertManager.h>
+#include <fizz/server/FizzServerContext.h>
+#include <folly/FileUtil.h>
+#include <proxygen/httpserver/RequestHandlerAdaptor.h>
+#include <proxygen/lib/http/session/HQDownstreamSession.h>
+#include <proxygen/lib/http/session/HTTPSessionController.h>
+#include <proxygen/lib/http/session/HTTPTransaction.h>
+#include <quic/server/QuicServer.h>
+#include <quic/server/QuicServerTransport.h>
+#include <quic/server/QuicServerTransportFactory.h>
+#include <stdexcept>
+
+namespace {
+
+// One per QUIC connection: creates its HQDownstreamSession, routes requests
+// to the factory, and deletes itself once the session is gone.
+class H3SessionController : public proxygen::HTTPSessionController {
+ public:
+  H3SessionController(proxygen::RequestHandlerFactory* factory, std::chrono::milliseconds txnTimeout)
+    : factory_(factory), txnTimeout_(txnTimeout) {}
+
+  proxygen::HQSession* createSession() {
+    wangle::TransportInfo tinfo;
+    session_ = new proxygen::HQDownstreamSession(txnTimeout_, this, tinfo, nullptr);
+    return session_;
+  }
+
+  void startSession(std::shared_ptr<quic::QuicSocket> sock) {
+    session_->setSocket(std::move(sock));
+    session_->startNow();
+  }
+
+  proxygen::HTTPTransactionHandler* getRequestHandler(proxygen::HTTPTransaction&,
+                                                      proxygen::HTTPMessage* msg) override {
+    return new proxygen::RequestHandlerAdaptor(factory_->onRequest(nullptr, msg));
+  }
+  // nullptr: proxygen answers parse errors and timeouts with its defaults.
+  proxygen::HTTPTransactionHandler* getParseErrorHandler(proxygen::HTTPTransaction*,
+                                                         const proxygen::HTTPException&,
+                                                         const folly::SocketAddress&) override {
+    return nullptr;
+  }
+  proxygen::HTTPTransactionHandler* getTransactionTimeoutHandler(proxygen::HTTPTransaction*,
+                                                                 const folly::SocketAddress&) override {
+    return nullptr;
+  }
+  void attachSession(proxygen::HTTPSessionBase*) override {}
+  void detachSession(const proxygen::HTTPSessionBase*) override { delete this; }
+
+ private:
+  proxygen::RequestHandlerFactory* factory_;
+  std::chrono::milliseconds txnTimeout_;
+  proxygen::HQSession* session_ = nullptr;
+};
+
+class H3TransportFactory : public quic::QuicServerTransportFactory {
+ public:
+  H3TransportFactory(proxygen::RequestHandlerFactory* factory, std::chrono::milliseconds txnTimeout)
+    : factory_(factory), txnTimeout_(txnTimeout) {}
+
+  quic::QuicServerTransport::Ptr make(folly::EventBase* evb, std::unique_ptr<quic::FollyAsyncUDPSocketAlias> sock,
+                                      const folly::SocketAddress&, quic::QuicVersion,
+                                      std::shared_ptr<const fizz::server::FizzServerContext> ctx) noexcept override {
+    auto* controller = new H3SessionController(factory_, txnTimeout_);
+    auto* session = controller->createSession();
+    auto transport = quic::QuicServerTransport::make(evb, std::move(sock), session, session, std::move(ctx));
+    controller->startSession(transport);
+    return transport;
+  }
+
+ private:
+  proxygen::RequestHandlerFactory* factory_;
+  std::chrono::milliseconds txnTimeout_;
+};
+
+std::shared_ptr<fizz::server::FizzServerContext> fizzContext(const ServerConfig& cfg) {
+  std::string cert, key;
+  if (!folly::readFile(cfg.certFile.c_str(), cert) || !folly::readFile(cfg.keyFile.c_str(), key))
+    throw std::invalid_argument("H3: cannot read " + cfg.certFile + " / " + cfg.keyFile);
+  auto certs = std::make_shared<fizz::server::CertManager>();
+  certs->addCert(fizz::CertUtils::makeSelfCert(std::move(cert), std::move(key)), true);
+  auto ctx = std::make_shared<fizz::server::FizzServerContext>();
+  ctx->setCertManager(std::move(certs));
+  ctx->setSupportedAlpns({"h3"});
+  ctx->setVersionFallbackEnabled(false);
+  return ctx;
+}
+
+} // namespace
+
+H3Listener::H3Listener(const ServerConfig& cfg, proxygen::RequestHandlerFactory* factory)
+    : cfg_(cfg), factory_(factory) {
+  quic::TransportSettings ts;
+  ts.idleTimeout = cfg.idleTimeout;
+  ts.advertisedInitialMaxStreamsBidi = cfg.maxConcurrentStreams;
+  ts.advertisedInitialBidiLocalStreamFlowControlWindow = cfg.streamWindow;
+  ts.advertisedInitialBidiRemoteStreamFlowControlWindow = cfg.streamWindow;
+  ts.advertisedInitialUniStreamFlowControlWindow = cfg.streamWindow;
+  ts.advertisedInitialConnectionFlowControlWindow = cfg.sessionWindow;
+
+  server_ = quic::QuicServer::createQuicServer(std::move(ts));
+  server_->setQuicServerTransportFactory(std::make_unique<H3TransportFactory>(factory_, cfg.idleTimeout));
+  server_->setFizzContext(fizzContext(cfg));
+  server_->setSupportedVersion({quic::QuicVersion::QUIC_V1, quic::QuicVersion::QUIC_DRAFT});
+}
+
+H3Listener::~H3Listener() { stop(); }
+
+void H3Listener::start() {
+  server_->start(folly::SocketAddress(cfg_.host, cfg_.h3Port, true), cfg_.threads);
+  server_->waitUntilInitialized();
+}
+
+void H3Listener::stop() {
+  if (server_) server_->shutdown();
+}
+
+std::string H3Listener::altSvc() const {
+  return "h3=\":" + std::to_string(cfg_.h3Port) + "\"; ma=86400";
+}
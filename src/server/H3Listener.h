@@ -0,0 +1,34 @@
+#pragma once
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <memory>
+#include <string>
+
+#include "ServerConfig.h"
+
+namespace quic { class QuicServer; }
+
+// HTTP/3 listener: an mvfst QuicServer on UDP `h3Port` whose transports
+// each carry a proxygen HQDownstreamSession, handing every request to the
+// same RequestHandlerFactory the TCP listeners use (wrapped in a
+// RequestHandlerAdaptor, as HTTPServer does). Only installed
+// proxygen/mvfst/fizz APIs are used. `factory` must outlive the listener.
+// Stream limits, flow-control windows and the idle timeout come from the
+// ServerConfig.
+class H3Listener {
+ public:
+  H3Listener(const ServerConfig& cfg, proxygen::RequestHandlerFactory* factory);
+  ~H3Listener();
+  H3Listener(const H3Listener&) = delete;
+  H3Listener& operator=(const H3Listener&) = delete;
+
+  void start();
+  void stop();
+
+  // Value for the Alt-Svc header that points TCP clients at this listener.
+  std::string altSvc() const;
+
+ private:
+  ServerConfig cfg_;
+  proxygen::RequestHandlerFactory* factory_;
+  std::shared_ptr<quic::QuicServer> server_;
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include <folly/SocketAddress.h>
+#include <proxygen/httpserver/HTTPServer.h>
+#include <proxygen/httpserver/HTTPServerOptions.h>
+#include <wangle/ssl/SSLContextConfig.h>
+#include <wangle/ssl/TLSTicketKeySeeds.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Listeners and transport settings, read from the environment (main loads
+// .env first). Every listener serves the same handler factory:
+//
+//   HTTP_PORT              plaintext HTTP/1.1, plus h2c when H2C=1 (default)
+//   TLS_PORT               TLS, h2 or http/1.1 by ALPN; needs TLS_CERT/TLS_KEY
+//   H3_PORT                HTTP/3 over QUIC (UDP); same certificate
+//   TLS_TICKET_SEEDS       wangle ticket seed file shared by a fleet (watched);
+//                          without it seeds are generated in-process
+//   TLS_TICKET_ROTATE_S    in-process ticket key rotation period
+//   TLS_KTLS               offload record crypto to kernel TLS if available (1)
+//   THREADS                IO threads per server (0: one per core)
+//   IDLE_TIMEOUT_MS        idle connection timeout
+//   MAX_CONCURRENT_STREAMS per h2/h3 connection
+//   STREAM_WINDOW_BYTES    initial per-stream flow-control window
+//   SESSION_WINDOW_BYTES   per-connection flow-control window
+//
+// A port of 0 turns that listener off.
+struct ServerConfig {
+  std::string host = "0.0.0.0";
+  uint16_t httpPort = 8080;
+  bool h2c = true;
+  uint16_t tlsPort = 0;
+  uint16_t h3Port = 0;
+  std::string certFile, keyFile;
+  std::string ticketSeedFile;
+  std::chrono::seconds ticketRotation{3600};
+  bool ktls = true;
+  size_t threads = 0;
+  std::chrono::milliseconds idleTimeout{60000};
+  uint32_t maxConcurrentStreams = 100;
+  uint32_t streamWindow = 1 << 20;
+  uint32_t sessionWindow = 4 << 20;
+
+  static ServerConfig fromEnv() {
+    ServerConfig c;
+    if (auto* v = std::getenv("HOST")) c.host = v;
+    c.httpPort = uint16_t(num("HTTP_PORT", c.httpPort));
+    c.h2c = num("H2C", c.h2c) != 0;
+    c.tlsPort = uint16_t(num("TLS_PORT", c.tlsPort));
+    c.h3Port = uint16_t(num("H3_PORT", c.h3Port));
+    if (auto* v = std::getenv("TLS_CERT")) c.certFile = v;
+    if (auto* v = std::getenv("TLS_KEY")) c.keyFile = v;
+    if (auto* v = std::getenv("TLS_TICKET_SEEDS")) c.ticketSeedFile = v;
+    c.ticketRotation = std::chrono::seconds(num("TLS_TICKET_ROTATE_S", c.ticketRotation.count()));
+    c.ktls = num("TLS_KTLS", c.ktls) != 0;
+    c.threads = size_t(num("THREADS", c.threads));
+    c.idleTimeout = std::chrono::milliseconds(num("IDLE_TIMEOUT_MS", c.idleTimeout.count()));
+    c.maxConcurrentStreams = uint32_t(num("MAX_CONCURRENT_STREAMS", c.maxConcurrentStreams));
+    c.streamWindow = uint32_t(num("STREAM_WINDOW_BYTES", c.streamWindow));
+    c.sessionWindow = uint32_t(num("SESSION_WINDOW_BYTES", c.sessionWindow));
+    if (!c.threads) c.threads = std::thread::hardware_concurrency();
+    if ((c.tlsPort || c.h3Port) && (c.certFile.empty() || c.keyFile.empty()))
+      throw std::invalid_argument("TLS_PORT/H3_PORT need TLS_CERT and TLS_KEY");
+    return c;
+  }
+
+  // Transport settings for the TCP listeners (h1, h2c, h2).
+  void apply(proxygen::HTTPServerOptions& opt) const {
+    opt.threads = threads;
+    opt.idleTimeout = idleTimeout;
+    opt.h2cEnabled = h2c;
+    opt.maxConcurrentIncomingStreams = maxConcurrentStreams;
+    opt.initialReceiveWindow = streamWindow;
+    opt.receiveStreamWindowSize = streamWindow;
+    opt.receiveSessionWindowSize = sessionWindow;
+  }
+
+  // `seeds` are the initial session-ticket keys for the TLS listener.
+  std::vector<proxygen::HTTPServer::IPConfig> tcpListeners(
+      const wangle::TLSTicketKeySeeds& seeds = {}) const {
+    std::vector<proxygen::HTTPServer::IPConfig> out;
+    if (httpPort)
+      out.emplace_back(folly::SocketAddress(host, httpPort, true), proxygen::HTTPServer::Protocol::HTTP);
+    if (tlsPort) {
+      proxygen::HTTPServer::IPConfig tls(folly::SocketAddress(host, tlsPort, true),
+                                         proxygen::HTTPServer::Protocol::HTTP);
+      wangle::SSLContextConfig ssl;
+      ssl.isDefault = true;
+      ssl.setCertificate(certFile, keyFile, "");
+      ssl.setNextProtocols({"h2", "http/1.1"});
+      // Resumption is stateless: tickets only, no per-process session cache.
+      ssl.sessionCacheEnabled = false;
+      ssl.sessionTicketEnabled = true;
+      tls.sslConfigs.push_back(std::move(ssl));
+      tls.ticketSeeds = seeds;
+      out.push_back(std::move(tls));
+    }
+    return out;
+  }
+
+ private:
+  static long long num(const char* name, long long d) {
+    const char* v = std::getenv(name);
+    return v && *v ? std::atoll(v) : d;
+  }
+};
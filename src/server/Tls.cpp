@@ -0,0 +1,183 @@
+#include "Tls.h"
+
+#include <folly/Random.h>
+#include <folly/String.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <openssl/conf.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TLS_TX
+#define TLS_TX 1
+#endif
+
+namespace {
+
+std::string randomSeed() {
+  std::array<uint8_t, 32> b;
+  folly::Random::secureRandom(b.data(), b.size());
+  return folly::hexlify(folly::ByteRange(b.data(), b.size()));
+}
+
+// The tls ULP can only be attached to a connected socket, so probe with a
+// throwaway loopback connection (this also autoloads the module).
+bool kernelHasTlsUlp() {
+  int l = socket(AF_INET, SOCK_STREAM, 0), c = socket(AF_INET, SOCK_STREAM, 0), a = -1;
+  bool ok = false;
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (l >= 0 && c >= 0 && bind(l, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(l, 1) == 0 &&
+      getsockname(l, (sockaddr*)&addr, &len) == 0 && connect(c, (sockaddr*)&addr, sizeof(addr)) == 0 &&
+      (a = accept(l, nullptr, nullptr)) >= 0)
+    ok = setsockopt(c, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0;
+  for (int fd : {a, c, l}) if (fd >= 0) close(fd);
+  return ok;
+}
+
+// Succeeds only once a TX crypto state has been installed on the socket.
+bool sendOffloaded(int fd) {
+  std::array<uint8_t, 128> info;
+  socklen_t len = info.size();
+  return getsockopt(fd, SOL_TLS, TLS_TX, info.data(), &len) == 0;
+}
+
+class TlsStatsFilter : public proxygen::Filter {
+ public:
+  TlsStatsFilter(proxygen::RequestHandler* upstream, TlsStatsFactory& stats)
+      : Filter(upstream), stats_(stats) {}
+
+  void onRequest(std::unique_ptr<proxygen::HTTPMessage> msg) noexcept override {
+    stats_.connection(*downstream_);
+    Filter::onRequest(std::move(msg));
+  }
+
+ private:
+  TlsStatsFactory& stats_;
+};
+
+} // namespace
+
+// =====================================================
+// TicketKeys
+// =====================================================
+TicketKeys::TicketKeys(const ServerConfig& cfg, Metrics* metrics) : cfg_(cfg) {
+  if (metrics) rotations_ = &metrics->counter("tls_ticket_key_rotations_total");
+  if (!cfg_.ticketSeedFile.empty()) {
+    auto seeds = wangle::TLSCredProcessor::processTLSTickets(cfg_.ticketSeedFile);
+    if (!seeds) throw std::invalid_argument("TLS_TICKET_SEEDS: cannot parse " + cfg_.ticketSeedFile);
+    seeds_ = std::move(*seeds);
+  } else {
+    seeds_.oldSeeds = {randomSeed()};
+    seeds_.currentSeeds = {randomSeed()};
+    seeds_.newSeeds = {randomSeed()};
+  }
+}
+
+TicketKeys::~TicketKeys() { stop(); }
+
+wangle::TLSTicketKeySeeds TicketKeys::initial() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return seeds_;
+}
+
+void TicketKeys::start(proxygen::HTTPServer& srv) {
+  std::lock_guard<std::mutex> lk(mu_);
+  srv_ = &srv;
+  if (!cfg_.ticketSeedFile.empty()) {
+    watcher_ = std::make_unique<wangle::TLSCredProcessor>();
+    watcher_->addTicketCallback([this](wangle::TLSTicketKeySeeds seeds) {
+      std::lock_guard<std::mutex> lk(mu_);
+      seeds_ = seeds;
+      if (srv_) srv_->updateTicketSeeds(std::move(seeds));
+      if (rotations_) rotations_->fetch_add(1, std::memory_order_relaxed);
+    });
+    watcher_->setTicketPathToWatch(cfg_.ticketSeedFile);
+  } else if (cfg_.ticketRotation.count() > 0) {
+    rotator_ = std::thread([this] { rotate(); });
+  }
+}
+
+void TicketKeys::stop() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stopping_ = true;
+    srv_ = nullptr;
+  }
+  cv_.notify_all();
+  if (rotator_.joinable()) rotator_.join();
+  watcher_.reset();
+}
+
+void TicketKeys::rotate() {
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!cv_.wait_for(lk, cfg_.ticketRotation, [this] { return stopping_; })) {
+    seeds_.oldSeeds = std::move(seeds_.currentSeeds);
+    seeds_.currentSeeds = std::move(seeds_.newSeeds);
+    seeds_.newSeeds = {randomSeed()};
+    if (srv_) srv_->updateTicketSeeds(seeds_);
+    if (rotations_) rotations_->fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+// =====================================================
+// Kernel TLS
+// =====================================================
+bool enableKernelTls() {
+  if (!kernelHasTlsUlp()) return false;
+  // OpenSSL applies "system_default" to every SSL_CTX it creates; loading it
+  // from a config module reaches the contexts wangle builds for us.
+  char path[] = "/tmp/ktls-XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) return false;
+  static const char kConf[] =
+    "openssl_conf = conf\n[conf]\nssl_conf = ssl\n[ssl]\nsystem_default = tls\n[tls]\nOptions = KTLS\n";
+  const bool written = write(fd, kConf, sizeof(kConf) - 1) == ssize_t(sizeof(kConf) - 1);
+  close(fd);
+  const bool ok = written && CONF_modules_load_file(path, nullptr, 0) > 0;
+  unlink(path);
+  return ok;
+}
+
+// =====================================================
+// TlsStatsFactory
+// =====================================================
+TlsStatsFactory::TlsStatsFactory(Metrics* metrics)
+    : handshakes_(metrics->counter("tls_handshakes_total")),
+      resumed_(metrics->counter("tls_resumed_total")),
+      ktls_(metrics->counter("tls_ktls_connections_total")),
+      setup_(metrics->histogram("tls_handshake_duration_seconds")) {}
+
+proxygen::RequestHandler* TlsStatsFactory::onRequest(proxygen::RequestHandler* h,
+                                                     proxygen::HTTPMessage* msg) noexcept {
+  if (!msg->isSecure() || msg->getSeqNo() != 0) return h;
+  return new TlsStatsFilter(h, *this);
+}
+
+void TlsStatsFactory::connection(proxygen::ResponseHandler& downstream) {
+  const auto& info = downstream.getSetupTransportInfo();
+  handshakes_.fetch_add(1, std::memory_order_relaxed);
+  if (info.sslResume == wangle::SSLResumeEnum::RESUME_TICKET ||
+      info.sslResume == wangle::SSLResumeEnum::RESUME_SESSION_ID)
+    resumed_.fetch_add(1, std::memory_order_relaxed);
+  setup_.record(uint64_t(info.sslSetupTime.count()) * 1000);
+
+  auto* txn = downstream.getTransaction();
+  const auto* transport = txn ? txn->getTransport().getUnderlyingTransport() : nullptr;
+  const auto* sock = transport ? transport->getUnderlyingTransport<folly::AsyncSocket>() : nullptr;
+  if (sock && sendOffloaded(sock->getNetworkSocket().toFd()))
+    ktls_.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <proxygen/httpserver/Filters.h>
+#include <proxygen/httpserver/HTTPServer.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <wangle/ssl/TLSCredProcessor.h>
+#include <wangle/ssl/TLSTicketKeySeeds.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "ServerConfig.h"
+#include "../router/Metrics.h"
+
+// ----------------------------
+// Session tickets
+// ----------------------------
+// Ticket keys for the TLS listener. With TLS_TICKET_SEEDS the seeds come
+// from wangle's JSON seed file, which is watched and reloaded so every
+// instance behind a balancer can decrypt every ticket. Without it, seeds are
+// random and rotated in-process every `ticketRotation`: new -> current ->
+// old, so a ticket stays redeemable for two periods after it is issued.
+class TicketKeys {
+ public:
+  TicketKeys(const ServerConfig& cfg, Metrics* metrics = nullptr);
+  ~TicketKeys();
+  TicketKeys(const TicketKeys&) = delete;
+  TicketKeys& operator=(const TicketKeys&) = delete;
+
+  // Seeds to bind the listener with.
+  wangle::TLSTicketKeySeeds initial() const;
+  // Pushes later rotations into `srv` until stop().
+  void start(proxygen::HTTPServer& srv);
+  void stop();
+
+ private:
+  void rotate();
+
+  const ServerConfig cfg_;
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  wangle::TLSTicketKeySeeds seeds_;
+  proxygen::HTTPServer* srv_ = nullptr;
+  bool stopping_ = false;
+  std::thread rotator_;
+  std::unique_ptr<wangle::TLSCredProcessor> watcher_;
+  std::atomic<uint64_t>* rotations_ = nullptr;
+};
+
+// ----------------------------
+// Kernel TLS
+// ----------------------------
+// Turns on OpenSSL's kTLS option for every SSL context created afterwards,
+// so once a handshake completes record encryption moves into the kernel and
+// response bodies go out with plain sends instead of a userspace encrypt and
+// copy. Call before the server is built. Returns false (and changes nothing)
+// when the kernel has no TLS ULP; connections OpenSSL cannot offload (cipher,
+// version, OpenSSL build) keep working in userspace.
+bool enableKernelTls();
+
+// ----------------------------
+// TLS connection stats
+// ----------------------------
+// Outermost handler factory: on the first request of each TLS connection it
+// records the handshake (full or resumed, setup time) and whether the
+// connection's send path was offloaded to kTLS. Other requests pass through
+// untouched. Rate of tls_handshakes_total is handshakes per second;
+// tls_resumed_total / tls_handshakes_total is the resumption rate.
+class TlsStatsFactory : public proxygen::RequestHandlerFactory {
+ public:
+  explicit TlsStatsFactory(Metrics* metrics);
+
+  void onServerStart(folly::EventBase*) noexcept override {}
+  void onServerStop() noexcept override {}
+  proxygen::RequestHandler* onRequest(proxygen::RequestHandler* h,
+                                      proxygen::HTTPMessage* msg) noexcept override;
+
+  void connection(proxygen::ResponseHandler& downstream);
+
+ private:
+  std::atomic<uint64_t>& handshakes_;
+  std::atomic<uint64_t>& resumed_;
+  std::atomic<uint64_t>& ktls_;
+  LatencyHistogram& setup_;
+};
@@ -0,0 +1,7 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+
+// Fails the test (exit 1) with the condition's text and location.
+#define CHECK(cond) \
+  do { if (!(cond)) { std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); std::exit(1); } } while (0)
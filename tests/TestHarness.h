@@ -0,0 +1,68 @@
+#pragma once
+// Drives RouterFactory the way proxygen does (onRequest on the factory,
+// then onRequest/onEOM/requestComplete on the handler) without a server:
+// responses go to a downstream that keeps only the status code.
+#include <proxygen/httpserver/RequestHandler.h>
+#include <proxygen/httpserver/ResponseHandler.h>
+#include <proxygen/lib/http/HTTPMessage.h>
+#include <memory>
+#include <string>
+
+#include "Check.h"
+#include "../src/router/Router.h"
+
+class Nothing : public proxygen::RequestHandler {
+ public:
+  void onRequest(std::unique_ptr<proxygen::HTTPMessage>) noexcept override {}
+  void onBody(std::unique_ptr<folly::IOBuf>) noexcept override {}
+  void onEOM() noexcept override {}
+  void onUpgrade(proxygen::UpgradeProtocol) noexcept override {}
+  void requestComplete() noexcept override {}
+  void onError(proxygen::ProxygenError) noexcept override {}
+};
+
+// Accepts a response and throws it away, remembering its status.
+class NullDownstream : public proxygen::ResponseHandler {
+ public:
+  explicit NullDownstream(proxygen::RequestHandler* upstream) : ResponseHandler(upstream) {}
+  void sendHeaders(proxygen::HTTPMessage& m) noexcept override { status = m.getStatusCode(); }
+  void sendChunkHeader(size_t) noexcept override {}
+  void sendBody(std::unique_ptr<folly::IOBuf>) noexcept override {}
+  void sendChunkTerminator() noexcept override {}
+  void sendEOM() noexcept override {}
+  void sendAbort() noexcept override {}
+  void refreshTimeout() noexcept override {}
+  void pauseIngress() noexcept override {}
+  void resumeIngress() noexcept override {}
+  proxygen::ResponseHandler* newPushedResponse(proxygen::PushHandler*) noexcept override { return nullptr; }
+  const wangle::TransportInfo& getSetupTransportInfo() const noexcept override { return info_; }
+  void getCurrentTransportInfo(wangle::TransportInfo*) const override {}
+
+  uint16_t status = 0;
+
+ private:
+  wangle::TransportInfo info_;
+};
+
+inline std::unique_ptr<proxygen::HTTPMessage> request(proxygen::HTTPMethod method, const char* url) {
+  auto m = std::make_unique<proxygen::HTTPMessage>();
+  m->setMethod(method);
+  m->setURL(url);
+  m->getHeaders().add(proxygen::HTTP_HEADER_HOST, "localhost");
+  return m;
+}
+
+// One request through the router, answered inline.
+inline void drive(RouterFactory& router, proxygen::ResponseHandler& down,
+                  std::unique_ptr<proxygen::HTTPMessage> m) {
+  auto* h = router.onRequest(nullptr, m.get());
+  h->setResponseHandler(&down);
+  h->onRequest(std::move(m));
+  h->onEOM();
+  h->requestComplete();
+}
+
+// Whether m's Prometheus text has `line` as a line of its own.
+inline bool renders(Metrics& m, const std::string& line) {
+  return ("\n" + m.render()).find("\n" + line + "\n") != std::string::npos;
+}
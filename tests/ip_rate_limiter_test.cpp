@@ -0,0 +1,59 @@
+// IpRateLimiter token buckets, driven with explicit times (ms on the
+// limiter's wrapping 32-bit clock) instead of steady_clock.
+#include "Check.h"
+#include "../src/router/Admission.h"
+
+namespace {
+
+constexpr uint32_t kDay = 24 * 3600 * 1000;
+
+IpRateLimiter limiter() {
+  AdmissionOptions o;
+  o.ipRate = 1;   // a token a second
+  o.ipBurst = 2;  // full after 2s
+  return IpRateLimiter(o, nullptr);
+}
+
+// Takes every token left in `ip`'s bucket at `now`.
+void drain(IpRateLimiter& l, const char* ip, uint32_t now) {
+  while (l.allow(ip, now)) {}
+}
+
+} // namespace
+
+int main() {
+  {  // burst, then one token per second
+    auto l = limiter();
+    CHECK(l.allow("10.0.0.1", 1000));
+    CHECK(l.allow("10.0.0.1", 1000));
+    CHECK(!l.allow("10.0.0.1", 1000));
+    CHECK(!l.allow("10.0.0.1", 1500));
+    CHECK(l.allow("10.0.0.1", 2000));
+    CHECK(!l.allow("10.0.0.1", 2000));
+    CHECK(l.allow("10.0.0.2", 2000));  // other clients have their own bucket
+  }
+  {  // a thread whose `now` trails the stored time refills nothing
+    auto l = limiter();
+    drain(l, "10.0.0.1", 10000);
+    CHECK(!l.allow("10.0.0.1", 9990));
+    CHECK(!l.allow("10.0.0.1", 10990));  // still counted from 10000
+    CHECK(l.allow("10.0.0.1", 11000));
+  }
+  // A bucket left alone for weeks is full again, whatever the clock wrap
+  // makes of the gap (past 2^31 ms it reads as negative).
+  for (uint32_t days : {1u, 20u, 25u, 30u, 45u}) {
+    auto l = limiter();
+    drain(l, "10.0.0.1", 5000);
+    const uint32_t later = 5000 + days * kDay;
+    CHECK(l.allow("10.0.0.1", later));
+    CHECK(l.allow("10.0.0.1", later));
+    CHECK(!l.allow("10.0.0.1", later));
+  }
+  {  // across the wrap itself
+    auto l = limiter();
+    drain(l, "10.0.0.1", UINT32_MAX - 500);
+    CHECK(!l.allow("10.0.0.1", 100));
+    CHECK(l.allow("10.0.0.1", 600));
+  }
+  std::puts("ok");
+}
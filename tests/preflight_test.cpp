@@ -0,0 +1,35 @@
+// A CORS preflight is answered by the CORS before-step; the request-id
+// step that ran ahead of it must still count the request as finished.
+#include "TestHarness.h"
+
+int main() {
+  Metrics metrics;
+  RouterFactory router;
+  router.useRequestIdLoggingAndMetrics(&metrics);
+  router.useCompression();
+  AdmissionOptions admission;
+  admission.enabled = true;
+  router.admission(admission);
+  auto api = router.group("/api/v1");
+  api.useCORS();
+  api.get("/users/:id", [](Res& res) { res.status(204, "No Content"); }).admissionClass("db");
+  router.freeze();
+
+  Nothing upstream;
+  NullDownstream down(&upstream);
+  for (int i = 0; i < 3; i++) {
+    auto m = request(proxygen::HTTPMethod::OPTIONS, "/api/v1/users/42");
+    m->getHeaders().add(proxygen::HTTP_HEADER_ORIGIN, "https://example.com");
+    m->getHeaders().add(proxygen::HTTP_HEADER_ACCESS_CONTROL_REQUEST_METHOD, "GET");
+    drive(router, down, std::move(m));
+    CHECK(down.status == 204);
+  }
+  CHECK(renders(metrics, "http_in_flight 0"));
+  CHECK(renders(metrics, "http_requests_total 3"));
+
+  // An ordinary request on the same chain still goes through the handler.
+  drive(router, down, request(proxygen::HTTPMethod::GET, "/api/v1/users/42"));
+  CHECK(down.status == 204);
+  CHECK(renders(metrics, "http_in_flight 0"));
+  CHECK(renders(metrics, "http_requests_total 4"));
+}
@@ -0,0 +1,120 @@
+// Heap allocations the router makes per request, on the hot path main.cpp
+// serves most: a cache hit on GET /api/v1/users/:id through the same
+// middleware (request id + metrics + access log, compression, CORS on the
+// group), coalescing and the "db" admission class. operator new is counted
+// and what proxygen's ResponseBuilder allocates to send the same response
+// on its own is subtracted. The handler block (RouteContext and Res
+// included) comes from the per-thread free list; what is left is listed
+// at kBudget, and the test fails if the router goes over it.
+//
+//   ./request_alloc_test [requests]
+#include "TestHarness.h"
+
+#include <proxygen/httpserver/ResponseBuilder.h>
+#include <folly/io/IOBuf.h>
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace {
+
+bool counting = false;
+uint64_t allocs = 0;
+
+} // namespace
+
+void* operator new(size_t sz) {
+  if (counting) allocs++;
+  if (void* p = std::malloc(sz ? sz : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+// Router allocations per request:
+//   1  x-request-id value (32 chars, past the std::string inline buffer)
+//   1  coalescing key ("/api/v1/users/42?")
+//   3  in-flight entry: map node, its key, the SharedPromise
+//   1  content-type value ("application/json")
+//   1  body clone of the cached buffer
+//   3  snapshot handed to followers: the Snapshot, its body clone, its
+//      content-type header
+constexpr double kBudget = 10;
+
+constexpr const char* kUser = R"({"id":42,"username":"alice","email":"alice@example.com"})";
+
+std::vector<std::unique_ptr<proxygen::HTTPMessage>> messages(size_t n) {
+  std::vector<std::unique_ptr<proxygen::HTTPMessage>> v;
+  for (size_t i = 0; i < n; i++) {
+    auto m = request(proxygen::HTTPMethod::GET, "/api/v1/users/42");
+    m->getHeaders().add(proxygen::HTTP_HEADER_ACCEPT_ENCODING, "gzip, br");
+    m->getHeaders().add(proxygen::HTTP_HEADER_ORIGIN, "https://example.com");
+    v.push_back(std::move(m));
+  }
+  return v;
+}
+
+// Allocations per request through the router.
+double throughRouter(RouterFactory& router, NullDownstream& down, size_t n) {
+  auto msgs = messages(n);
+  allocs = 0;
+  counting = true;
+  for (auto& m : msgs) drive(router, down, std::move(m));
+  counting = false;
+  CHECK(down.status == 200);
+  return double(allocs) / double(n);
+}
+
+// Allocations per request for proxygen alone to send the same response.
+double builderOnly(proxygen::ResponseHandler& down, const folly::IOBuf& body, size_t n) {
+  allocs = 0;
+  counting = true;
+  for (size_t i = 0; i < n; i++) {
+    proxygen::ResponseBuilder(&down)
+      .status(200, "OK")
+      .header("x-request-id", "0123456789abcdef0123456789abcdef")
+      .header(proxygen::HTTP_HEADER_CONTENT_TYPE, "application/json")
+      .header(proxygen::HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN, "*")
+      .body(body.clone())
+      .sendWithEOM();
+  }
+  counting = false;
+  return double(allocs) / double(n);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+
+  Metrics metrics;
+  auto cached = folly::IOBuf::copyBuffer(kUser, std::strlen(kUser));
+
+  RouterFactory router;
+  router.useRequestIdLoggingAndMetrics(&metrics);
+  router.useCompression();
+  AdmissionOptions admission;
+  admission.enabled = true;
+  router.admission(admission);
+  auto api = router.group("/api/v1");
+  api.useCORS();
+  api.get("/users/:id", [&](Res& res) {
+    res.header("content-type", "application/json").body(cached->clone());
+  }).coalesce().admissionClass("db");
+  router.freeze();
+
+  Nothing upstream;
+  NullDownstream down(&upstream);
+  throughRouter(router, down, 1000);  // warm the free list, thread-locals and metrics
+  builderOnly(down, *cached, 1000);
+
+  const double total = throughRouter(router, down, n);
+  const double base = builderOnly(down, *cached, n);
+  std::printf("%-28s %10.2f\n", "allocs/request (total)", total);
+  std::printf("%-28s %10.2f\n", "allocs/request (proxygen)", base);
+  std::printf("%-28s %10.2f (budget %.0f)\n", "allocs/request (router)", total - base, kBudget);
+  CHECK(total - base <= kBudget);
+  CHECK(renders(metrics, "http_in_flight 0"));
+}
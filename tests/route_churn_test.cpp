@@ -0,0 +1,44 @@
+// Routes added and removed on a running router: the ids of removed routes
+// are reused, so churn neither grows the route table nor runs per-route
+// metrics out of ids (past Metrics::kMaxRoutes everything would land in
+// route="other").
+#include "TestHarness.h"
+
+#include <folly/synchronization/Hazptr.h>
+#include <algorithm>
+#include <string>
+
+int main() {
+  Metrics metrics;
+  RouterFactory router;
+  router.useRequestIdLoggingAndMetrics(&metrics);
+  router.freeze();
+
+  Nothing upstream;
+  NullDownstream down(&upstream);
+  int32_t maxId = -1;
+  const size_t cycles = Metrics::kMaxRoutes * 2;
+  for (size_t i = 0; i < cycles; i++) {
+    const std::string path = "/churn/" + std::to_string(i);
+    router.get(path, [&](Res& res) {
+      maxId = std::max(maxId, res.ctx().routeId);
+      res.status(204, "No Content");
+    });
+    router.freeze();
+    drive(router, down, request(proxygen::HTTPMethod::GET, path.c_str()));
+    CHECK(down.status == 204);
+    CHECK(router.remove(Method::Get, path));
+    router.freeze();
+    folly::hazptr_cleanup();  // let go of replaced snapshots now, not in a batch later
+  }
+  CHECK(maxId >= 0 && maxId < 4);
+
+  const std::string last = "/churn/" + std::to_string(cycles);
+  router.get(last, [](Res& res) { res.status(500, "Internal Server Error"); });
+  router.freeze();
+  drive(router, down, request(proxygen::HTTPMethod::GET, last.c_str()));
+  CHECK(down.status == 500);
+  // The reused id's series carry the new route's name and only its counts.
+  CHECK(renders(metrics, "http_request_errors_by_route_total{route=\"GET " + last + "\"} 1"));
+  CHECK(metrics.render().find("route=\"other\"") == std::string::npos);
+}